@@ -0,0 +1,381 @@
+/*
+ * Nilwm - Lightweight X window manager.
+ * See LICENSE file for copyright and license details.
+ */
+
+#include <stdlib.h>
+#include <string.h>
+#include <xcb/xcbext.h>
+#include "nilwm.h"
+
+#define MAX_TEXT_LONGS_     (1 << 18)   /* 1 MiB, longer text is cut */
+
+static
+int get_fd() {
+    return xcb_get_file_descriptor(nil_.con);
+}
+
+static
+int has_error() {
+    return xcb_connection_has_error(nil_.con);
+}
+
+static
+int flush() {
+    return xcb_flush(nil_.con);
+}
+
+static
+unsigned int no_operation() {
+    return xcb_no_operation(nil_.con).sequence;
+}
+
+static
+xcb_generic_event_t *poll_event() {
+    return xcb_poll_for_event(nil_.con);
+}
+
+static
+xcb_generic_event_t *poll_queued_event() {
+    return xcb_poll_for_queued_event(nil_.con);
+}
+
+/** Turn UTF-8 into the 8-bit characters drawn by draw_text, in place
+ * Characters beyond Latin-1 become '?'.
+ * @return the new length, never longer
+ */
+static
+int utf8_to_latin1(char *s, int len) {
+    unsigned int c;
+    int i, n;
+
+    for (i = n = 0; i < len; ) {
+        c = (uint8_t)s[i++];
+        if (c >= 0x80) {
+            if (((c & 0xe0) == 0xc0) && (i < len)
+                && (((uint8_t)s[i] & 0xc0) == 0x80)) {
+                c = ((c & 0x1f) << 6) | ((uint8_t)s[i++] & 0x3f);
+            } else {
+                c = 0x100;
+            }
+            while ((i < len) && (((uint8_t)s[i] & 0xc0) == 0x80)) {
+                c = 0x100;
+                ++i;
+            }
+            if (c > 0xff) {
+                c = '?';
+            }
+        }
+        s[n++] = (char)c;
+    }
+    return n;
+}
+
+/** Copy a text property in STRING or UTF8_STRING encoding
+ * @return -1 if it is not text
+ */
+static
+int read_text(xcb_get_property_reply_t *reply, struct text_t *t) {
+    int len;
+
+    len = xcb_get_property_value_length(reply);
+    if (((reply->type != XCB_ATOM_STRING)
+        && (reply->type != nil_.atom.utf8_string)) || (reply->format != 8)
+        || (reserve_text(t, len) != 0)) {
+        return -1;
+    }
+    if (reply->bytes_after > 0) {
+        NIL_ERR("text property cut at %d bytes", len);
+    }
+    memcpy(t->s, xcb_get_property_value(reply), len);
+    if (reply->type != XCB_ATOM_STRING) {
+        len = utf8_to_latin1(t->s, len);
+    }
+    t->s[len] = '\0';
+    t->len = len;
+    return 0;
+}
+
+/** Send every request needed to manage a window, replies are read later by
+ * read_window so they all arrive in a single round trip.
+ */
+static
+void query_window(xcb_window_t win, struct client_query_t *q) {
+    q->win = win;
+    q->attr = xcb_get_window_attributes_unchecked(nil_.con, win);
+    q->geom = xcb_get_geometry_unchecked(nil_.con, win);
+    q->hints = xcb_icccm_get_wm_normal_hints_unchecked(nil_.con, win);
+    q->proto = xcb_icccm_get_wm_protocols_unchecked(nil_.con, win,
+        nil_.atom.wm_protocols);
+    q->name = xcb_get_property_unchecked(nil_.con, 0, win, XCB_ATOM_WM_NAME,
+        XCB_GET_PROPERTY_TYPE_ANY, 0, MAX_TEXT_LONGS_);
+    q->net_name = xcb_get_property_unchecked(nil_.con, 0, win,
+        nil_.atom.net_wm_name, XCB_GET_PROPERTY_TYPE_ANY, 0, MAX_TEXT_LONGS_);
+}
+
+static
+void discard_window(struct client_query_t *q) {
+    xcb_discard_reply(nil_.con, q->attr.sequence);
+    xcb_discard_reply(nil_.con, q->geom.sequence);
+    xcb_discard_reply(nil_.con, q->hints.sequence);
+    xcb_discard_reply(nil_.con, q->proto.sequence);
+    xcb_discard_reply(nil_.con, q->name.sequence);
+    xcb_discard_reply(nil_.con, q->net_name.sequence);
+}
+
+/** Read the replies of query_window
+ * @return -1 if the window is gone
+ */
+static
+int read_window(struct client_query_t *q, struct window_info_t *info) {
+    xcb_get_window_attributes_reply_t *attr;
+    xcb_get_geometry_reply_t *geo;
+    xcb_size_hints_t sz;
+    xcb_icccm_get_wm_protocols_reply_t proto;
+    xcb_get_property_reply_t *name;
+    struct text_t title;
+    unsigned int i;
+
+    memset(info, 0, sizeof(struct window_info_t));
+    attr = xcb_get_window_attributes_reply(nil_.con, q->attr, 0);
+    if (!attr) {
+        xcb_discard_reply(nil_.con, q->geom.sequence);
+        xcb_discard_reply(nil_.con, q->hints.sequence);
+        xcb_discard_reply(nil_.con, q->proto.sequence);
+        xcb_discard_reply(nil_.con, q->name.sequence);
+        xcb_discard_reply(nil_.con, q->net_name.sequence);
+        return -1;
+    }
+    info->override_redirect = attr->override_redirect;
+    info->map_state = attr->map_state;
+    free(attr);
+    geo = xcb_get_geometry_reply(nil_.con, q->geom, 0);
+    if (geo) {
+        info->has_geom = 1;
+        info->geom.x = geo->x;
+        info->geom.y = geo->y;
+        info->geom.w = geo->width;
+        info->geom.h = geo->height;
+        free(geo);
+    }
+    if (xcb_icccm_get_wm_protocols_reply(nil_.con, q->proto, &proto, 0)) {
+        for (i = 0; i < proto.atoms_len; i++) {
+            if (proto.atoms[i] == nil_.atom.wm_delete) {
+                info->wm_delete = 1;
+                break;
+            }
+        }
+        xcb_icccm_get_wm_protocols_reply_wipe(&proto);
+    }
+    /* _NET_WM_NAME is preferred, as by later title fetches */
+    memset(&title, 0, sizeof(title));
+    name = xcb_get_property_reply(nil_.con, q->net_name, 0);
+    if (name && (read_text(name, &title) == 0)) {
+        info->net_name = 1;
+    }
+    free(name);
+    name = xcb_get_property_reply(nil_.con, q->name, 0);
+    if (name && !info->net_name) {
+        read_text(name, &title);
+    }
+    free(name);
+    info->title = title.s;
+    if (xcb_icccm_get_wm_normal_hints_reply(nil_.con, q->hints, &sz, 0)) {
+        if (NIL_HAS_FLAG(sz.flags, XCB_ICCCM_SIZE_HINT_P_MIN_SIZE)) {
+            info->min_w = sz.min_width;
+            info->min_h = sz.min_height;
+        }
+        if (NIL_HAS_FLAG(sz.flags, XCB_ICCCM_SIZE_HINT_P_MAX_SIZE)) {
+            info->max_w = sz.max_width;
+            info->max_h = sz.max_height;
+        }
+    }
+    return 0;
+}
+
+static
+void configure_window(xcb_window_t win, uint16_t mask, const uint32_t *vals) {
+    xcb_configure_window(nil_.con, win, mask, vals);
+}
+
+static
+void change_window_attributes(xcb_window_t win, uint32_t mask,
+    const uint32_t *vals) {
+    xcb_change_window_attributes(nil_.con, win, mask, vals);
+}
+
+static
+void map_window(xcb_window_t win) {
+    xcb_map_window(nil_.con, win);
+}
+
+static
+void unmap_window(xcb_window_t win) {
+    xcb_unmap_window(nil_.con, win);
+}
+
+/** Keep the position relative to the new parent
+ */
+static
+void reparent_window(xcb_window_t win, xcb_window_t parent, int16_t x,
+    int16_t y) {
+    xcb_reparent_window(nil_.con, win, parent, x, y);
+}
+
+static
+void change_save_set(uint8_t mode, xcb_window_t win) {
+    xcb_change_save_set(nil_.con, mode, win);
+}
+
+static
+void set_input_focus(xcb_window_t win) {
+    xcb_set_input_focus(nil_.con, XCB_INPUT_FOCUS_POINTER_ROOT, win,
+        XCB_CURRENT_TIME);
+}
+
+static
+void send_event(xcb_window_t win, const char *e) {
+    xcb_send_event(nil_.con, 0, win, XCB_EVENT_MASK_NO_EVENT, e);
+}
+
+static
+void kill_client(xcb_window_t win) {
+    xcb_kill_client(nil_.con, win);
+}
+
+/** Take control of the pointer in the root window
+ */
+static
+void grab_pointer(xcb_cursor_t cursor) {
+    xcb_grab_pointer(nil_.con, 0, nil_.scr->root,
+        XCB_EVENT_MASK_BUTTON_RELEASE | XCB_EVENT_MASK_BUTTON_MOTION,
+        XCB_GRAB_MODE_ASYNC, XCB_GRAB_MODE_ASYNC, XCB_NONE, cursor,
+        XCB_CURRENT_TIME);
+}
+
+static
+void ungrab_pointer() {
+    xcb_ungrab_pointer(nil_.con, XCB_CURRENT_TIME);
+}
+
+/** Move the pointer relative to a window
+ */
+static
+void warp_pointer(xcb_window_t win, int16_t x, int16_t y) {
+    xcb_warp_pointer(nil_.con, XCB_NONE, win, 0, 0, 0, 0, x, y);
+}
+
+static
+void allow_events(uint8_t mode, xcb_timestamp_t time) {
+    xcb_allow_events(nil_.con, mode, time);
+}
+
+static
+void fill_rectangle(xcb_drawable_t d, xcb_gcontext_t gc,
+    const xcb_rectangle_t *rect) {
+    xcb_poly_fill_rectangle(nil_.con, d, gc, 1, rect);
+}
+
+static
+void draw_text(xcb_drawable_t d, xcb_gcontext_t gc, int16_t x, int16_t y,
+    const char *str, uint8_t len) {
+    xcb_image_text_8(nil_.con, len, d, gc, x, y, str);
+}
+
+/** Copy a rectangle to the same position in another drawable
+ */
+static
+void copy_area(xcb_drawable_t src, xcb_drawable_t dst, xcb_gcontext_t gc,
+    const xcb_rectangle_t *rect) {
+    xcb_copy_area(nil_.con, src, dst, gc, rect->x, rect->y, rect->x, rect->y,
+        rect->width, rect->height);
+}
+
+/** Ask for a text property, its reply is read by poll_text_property
+ * The whole value is asked for, not the first 128 longs of xcb-icccm.
+ */
+static
+unsigned int query_text_property(xcb_window_t win, xcb_atom_t atom) {
+    return xcb_get_property(nil_.con, 0, win, atom, XCB_GET_PROPERTY_TYPE_ANY,
+        0, MAX_TEXT_LONGS_).sequence;
+}
+
+/** Read a text property if its reply has arrived
+ */
+static
+int poll_text_property(unsigned int seq, struct text_t *t) {
+    xcb_get_property_reply_t *reply;
+    xcb_generic_error_t *err;
+    int ret;
+
+    reply = 0;
+    err = 0;
+    if (!xcb_poll_for_reply(nil_.con, seq, (void **)&reply, &err)) {
+        return 0;
+    }
+    free(err);
+    if (!reply) {
+        return -1;
+    }
+    ret = (read_text(reply, t) == 0) ? 1 : -1;
+    free(reply);
+    return ret;
+}
+
+/** Send all key events to the wm, the reply is not waited for
+ */
+static
+void grab_keyboard() {
+    xcb_discard_reply(nil_.con, xcb_grab_keyboard(nil_.con, 0, nil_.scr->root,
+        XCB_CURRENT_TIME, XCB_GRAB_MODE_ASYNC, XCB_GRAB_MODE_ASYNC).sequence);
+}
+
+static
+void ungrab_keyboard() {
+    xcb_ungrab_keyboard(nil_.con, XCB_CURRENT_TIME);
+}
+
+/** Keyboard mapping is fetched once by xcb_key_symbols
+ */
+static
+xcb_keysym_t lookup_keysym(xcb_keycode_t code, int col) {
+    return xcb_key_symbols_get_keysym(nil_.key_syms, code, col);
+}
+
+/** Requests are sent to the X server through nil_.con
+ */
+const struct backend_t backend_xcb_ = {
+    .name                       = "xcb",
+    .get_fd                     = &get_fd,
+    .has_error                  = &has_error,
+    .flush                      = &flush,
+    .no_operation               = &no_operation,
+    .poll_event                 = &poll_event,
+    .poll_queued_event          = &poll_queued_event,
+    .query_window               = &query_window,
+    .discard_window             = &discard_window,
+    .read_window                = &read_window,
+    .configure_window           = &configure_window,
+    .change_window_attributes   = &change_window_attributes,
+    .map_window                 = &map_window,
+    .unmap_window               = &unmap_window,
+    .reparent_window            = &reparent_window,
+    .change_save_set            = &change_save_set,
+    .set_input_focus            = &set_input_focus,
+    .send_event                 = &send_event,
+    .kill_client                = &kill_client,
+    .grab_pointer               = &grab_pointer,
+    .ungrab_pointer             = &ungrab_pointer,
+    .warp_pointer               = &warp_pointer,
+    .allow_events               = &allow_events,
+    .fill_rectangle             = &fill_rectangle,
+    .draw_text                  = &draw_text,
+    .copy_area                  = &copy_area,
+    .query_text_property        = &query_text_property,
+    .poll_text_property         = &poll_text_property,
+    .grab_keyboard              = &grab_keyboard,
+    .ungrab_keyboard            = &ungrab_keyboard,
+    .lookup_keysym              = &lookup_keysym,
+};
+
+/* vim: set ts=4 sw=4 expandtab: */
@@ -3,39 +3,105 @@
  * See LICENSE file for copyright and license details.
  */
 
+/* The bar is drawn into a pixmap of the same size, the window shows it.
+ * Updates only mark their box, draw_bar redraws the marked boxes once per
+ * events batch and copies the changed span to the window in one request.
+ */
+
+#include <errno.h>
+#include <fcntl.h>
+#include <stdlib.h>
 #include <string.h>
+#include <unistd.h>
+#include <sys/stat.h>
 #include "nilwm.h"
 
 /* get padding for center alignment */
 #define CENTER_H_(W, L)     (((W) - (L)) / 2)
 #define CENTER_V_(H)        (((H) + nil_.font.ascent + nil_.font.descent) / 2 - nil_.font.descent)
-#define STATUS_LEN_         128
 #define STATUS_TEXT_        "NilWM"
+#define MAX_TEXT_           255     /* characters in one ImageText8 request */
+#define READ_SIZE_          256
+#define MAX_LINE_           4096    /* longer status lines are dropped */
 
 struct bar_t bar_;
-static char status_[STATUS_LEN_];
+static struct text_t status_;           /* shown */
+static struct text_t fetch_;            /* last reply, swapped with status_ */
+static unsigned int status_from_;       /* first character to redraw */
+static unsigned int status_seq_;        /* fetch waiting for its reply, or 0 */
+static int status_stale_;               /* changed since the last fetch */
+static int status_direct_;              /* set by the wm, WM_NAME is ignored */
+static unsigned long status_time_;      /* when the last fetch was sent (ms) */
+static struct watch_t status_watch_ = { .fd = -1 };     /* status FIFO */
+static struct client_t *task_;          /* its title is in the task box */
+static struct text_t input_;            /* FIFO data after the last line */
+static int input_skip_;                 /* dropping a line until its end */
+static unsigned int ws_lo_ = 1;         /* workspaces to redraw, none if lo > hi */
+static unsigned int ws_hi_;
+static int damage_x1_, damage_x2_;      /* span to copy, none if x1 >= x2 */
+
+/** Add a span of the pixmap to copy to the window
+ */
+static
+void damage(int x, int w) {
+    if (w <= 0) {
+        return;
+    }
+    if (damage_x1_ >= damage_x2_) {
+        damage_x1_ = x;
+        damage_x2_ = x + w;
+        return;
+    }
+    if (x < damage_x1_) {
+        damage_x1_ = x;
+    }
+    if (x + w > damage_x2_) {
+        damage_x2_ = x + w;
+    }
+}
+
+static
+void fill_bar(int x, int w, unsigned int scheme) {
+    xcb_rectangle_t rect;
+
+    rect.x = x;
+    rect.y = 0;
+    rect.width = w;
+    rect.height = bar_.h;
+    (*nil_.be->fill_rectangle)(bar_.pixmap, bar_.scheme[scheme].fill, &rect);
+    damage(x, w);
+}
+
+/** Draw a text of any length at x, centered vertically
+ */
+static
+void draw_bar_string(unsigned int scheme, int x, const char *s, int len) {
+    int n, w;
+
+    for (; len > 0; len -= n, s += n, x += w) {
+        n = (len > MAX_TEXT_) ? MAX_TEXT_ : len;
+        w = cal_text_width(s, n);
+        (*nil_.be->draw_text)(bar_.pixmap, bar_.scheme[scheme].text, x,
+            CENTER_V_(bar_.h), s, n);
+        damage(x, w);
+    }
+}
 
 void text_bar(int x, int y, const char *str) {
     int len;
 
     len = strlen(str);
-    xcb_image_text_8(nil_.con, len, bar_.win, bar_.gc, x, y, str);
+    (*nil_.be->draw_text)(bar_.pixmap, bar_.scheme[SCHEME_NORMAL].text, x, y,
+        str, len);
+    damage(x, cal_text_width(str, len));
 }
 
 static
 void draw_bar_text(struct bar_box_t *box, const char *s, int len) {
-    uint32_t vals[2];
     xcb_rectangle_t rect;
 
-    vals[0] = nil_.color.bar_fg;
-    vals[1] = nil_.color.bar_bg;
     if (box->w > 0) {           /* clear box before writing text */
-        rect.x = box->x;
-        rect.y = 0;
-        rect.width = box->w;
-        rect.height = bar_.h;
-        xcb_change_gc(nil_.con, bar_.gc, XCB_GC_FOREGROUND, &vals[1]);
-        xcb_poly_fill_rectangle(nil_.con, bar_.win, bar_.gc, 1, &rect);
+        fill_bar(box->x, box->w, SCHEME_NORMAL);
     }
     /* new pos/size */
     rect.width = cal_text_width(s, len);
@@ -57,9 +123,132 @@ void draw_bar_text(struct bar_box_t *box, const char *s, int len) {
         box->w = rect.width;
     }
     NIL_LOG("draw text %d in %d %u", rect.x, box->x, box->w);
-    xcb_change_gc(nil_.con, bar_.gc, XCB_GC_FOREGROUND | XCB_GC_BACKGROUND, vals);
-    xcb_image_text_8(nil_.con, len, bar_.win, bar_.gc, rect.x,
-        CENTER_V_(bar_.h), s);
+    /* image text fills its own background, a grown box needs no clear */
+    draw_bar_string(SCHEME_NORMAL, rect.x, s, len);
+}
+
+/** Redraw the status, only its changed tail if the width is the same
+ */
+static
+void draw_bar_status() {
+    struct bar_box_t *box;
+
+    box = &bar_.box[BAR_STATUS];
+    if ((status_from_ == 0)
+        || (cal_text_width(status_.s, status_.len) != box->w)) {
+        draw_bar_text(box, status_.s, status_.len);
+        return;
+    }
+    draw_bar_string(SCHEME_NORMAL,
+        box->x + cal_text_width(status_.s, status_from_),
+        status_.s + status_from_, status_.len - status_from_);
+}
+
+/** Nothing to show in the status, put the name instead
+ */
+static
+int fetch_default_status() {
+    int len;
+
+    len = strlen(STATUS_TEXT_);
+    if (reserve_text(&fetch_, len) != 0) {
+        return -1;
+    }
+    memcpy(fetch_.s, STATUS_TEXT_, len + 1);
+    fetch_.len = len;
+    return 0;
+}
+
+/** Show the fetched status unless it is the same
+ */
+static
+void set_status() {
+    struct text_t t;
+    unsigned int i;
+
+    if ((fetch_.len == status_.len) && ((status_.len == 0)
+        || (memcmp(fetch_.s, status_.s, status_.len) == 0))) {
+        return;
+    }
+    for (i = 0; (i < fetch_.len) && (i < status_.len)
+        && (fetch_.s[i] == status_.s[i]); ++i) {
+    }
+    /* a box already marked may need more */
+    if (!NIL_HAS_FLAG(bar_.box[BAR_STATUS].flags, BOX_DIRTY)
+        || (i < status_from_)) {
+        status_from_ = i;
+    }
+    t = status_;
+    status_ = fetch_;
+    fetch_ = t;
+    NIL_SET_FLAG(bar_.box[BAR_STATUS].flags, BOX_DIRTY);
+}
+
+/** Draw the cell of a workspace in the color of its state
+ */
+static
+void draw_bar_ws(unsigned int idx) {
+    unsigned int scheme;
+    char text[3];
+    int len, x, w;
+
+    if (idx == nil_.ws_idx) {               /* focused workspace */
+        scheme = SCHEME_SEL;
+    } else if (nil_.ws[idx].first) {        /* has a client */
+        scheme = SCHEME_OCC;
+    } else {
+        scheme = SCHEME_NORMAL;
+    }
+    w = bar_.box[BAR_WS].w / cfg_.num_workspaces;
+    x = bar_.box[BAR_WS].x + w * idx;
+    fill_bar(x, w, scheme);
+
+    len = snprintf(text, sizeof(text), "%u", idx + 1);
+    (*nil_.be->draw_text)(bar_.pixmap, bar_.scheme[scheme].text,
+        x + CENTER_H_(w, cal_text_width(text, len)), CENTER_V_(bar_.h),
+        text, len);
+}
+
+static
+void draw_bar_sym() {
+    const char *sym;
+
+    sym = (get_layout(&nil_.ws[nil_.ws_idx]))->symbol;
+    if (!sym) {
+        NIL_ERR("no layout symbol %d", nil_.ws_idx);
+        return;
+    }
+    draw_bar_text(&bar_.box[BAR_SYM], sym, strlen(sym));
+}
+
+/** Draw the title of the focused client in the space left by the status
+ * The title is cut at the last character that fits.
+ */
+static
+void draw_bar_task() {
+    struct bar_box_t *box;
+    const struct text_t *t;
+    unsigned int len;
+    int w;
+
+    box = &bar_.box[BAR_TASK];
+    w = bar_.box[BAR_STATUS].x - box->x;   /* status may cover the box */
+    box->w = (w > 0) ? w : 0;
+    if (box->w == 0) {
+        return;
+    }
+    fill_bar(box->x, box->w, SCHEME_NORMAL);
+    if (!task_) {
+        return;
+    }
+    t = &task_->title;
+    for (len = 0, w = 0; len < t->len; ++len) {
+        w += nil_.font.width[(uint8_t)t->s[len]];
+        if (w > box->w) {
+            break;
+        }
+    }
+    draw_bar_string(SCHEME_NORMAL, box->x, t->s, len);
 }
 
 /** Handle mouse click on workspace selection
@@ -82,12 +271,9 @@ void click_sym(struct bar_box_t *NIL_UNUSED(self), int NIL_UNUSED(x)) {
     set_layout(&arg);
 }
 
+/** Place the boxes and mark the whole bar for drawing
+ */
 void config_bar() {
-    unsigned int i;
-    int len, pad;
-    xcb_rectangle_t rect;
-    uint32_t vals[2];
-    char text[3];
     struct bar_box_t *box;
 
     /* workspace selection area */
@@ -96,29 +282,6 @@ void config_bar() {
     box->w = bar_.h * cfg_.num_workspaces;
     box->flags = BOX_FIXED;
     box->click = &click_ws;
-
-    /* colors */
-    vals[0] = nil_.color.bar_fg;
-    vals[1] = nil_.color.bar_bg;
-    xcb_change_gc(nil_.con, bar_.gc, XCB_GC_FOREGROUND, &vals[1]);
-
-    rect.width = bar_.w;
-    rect.height = bar_.h;
-    rect.x = 0;
-    rect.y = 0;
-    xcb_poly_fill_rectangle(nil_.con, bar_.win, bar_.gc, 1, &rect);
-
-    /* workspace numbers */
-    xcb_change_gc(nil_.con, bar_.gc, XCB_GC_FOREGROUND | XCB_GC_BACKGROUND, vals);
-    rect.x = 0;
-    rect.y = (rect.height + nil_.font.ascent + nil_.font.descent) / 2 - nil_.font.descent;
-    rect.width = bar_.h;
-    for (i = 1; i <= cfg_.num_workspaces; ++i) {
-        len = snprintf(text, sizeof(text), "%u", i);
-        pad = (rect.width - cal_text_width(text, len)) / 2; /* to align center */
-        xcb_image_text_8(nil_.con, len, bar_.win, bar_.gc, rect.x + pad, rect.y, text);
-        rect.x += rect.width;
-    }
     /* layout symbol (next to ws) */
     box = &bar_.box[BAR_SYM];
     box->x = 0 + bar_.box[BAR_WS].w;
@@ -143,6 +306,15 @@ void config_bar() {
     box->w = bar_.box[BAR_STATUS].x - bar_.box[BAR_TASK].x;
     box->flags = BOX_LEFT;
     box->click = 0;
+
+    /* pixmap content is undefined until drawn */
+    fill_bar(0, bar_.w, SCHEME_NORMAL);
+    NIL_SET_FLAG(bar_.box[BAR_SYM].flags, BOX_DIRTY);
+    NIL_SET_FLAG(bar_.box[BAR_STATUS].flags, BOX_DIRTY);
+    NIL_SET_FLAG(bar_.box[BAR_TASK].flags, BOX_DIRTY);
+    status_from_ = 0;
+    ws_lo_ = 0;
+    ws_hi_ = cfg_.num_workspaces - 1;
 }
 
 /** Handle mouse click on bar
@@ -164,56 +336,250 @@ int click_bar(int x) {
     return 0;
 }
 
+/** Copy again what the server lost, nothing is redrawn
+ */
+void expose_bar(int x, int w) {
+    damage(x, w);
+}
+
 void update_bar_ws(unsigned int idx) {
-    xcb_rectangle_t rect;
-    uint32_t vals[2];
-    char text[3];
-    int len;
+    if (ws_lo_ > ws_hi_) {
+        ws_lo_ = ws_hi_ = idx;
+        return;
+    }
+    if (idx < ws_lo_) {
+        ws_lo_ = idx;
+    } else if (idx > ws_hi_) {
+        ws_hi_ = idx;
+    }
+}
 
-    /* colors */
-    vals[0] = nil_.color.bar_fg;
-    if (idx == nil_.ws_idx) {               /* focused workspace */
-        vals[1] = nil_.color.bar_sel;
-    } else if (nil_.ws[idx].first) {        /* has a client */
-        vals[1] = nil_.color.bar_occ;
-    } else {
-        vals[1] = nil_.color.bar_bg;
+void update_bar_sym() {
+    NIL_SET_FLAG(bar_.box[BAR_SYM].flags, BOX_DIRTY);
+}
+
+/** The root WM_NAME changed, it is fetched by poll_bar_status
+ * It is ignored if the status comes from the FIFO or the modules.
+ */
+void update_bar_status() {
+    if (!status_direct_) {
+        status_stale_ = 1;
     }
-    xcb_change_gc(nil_.con, bar_.gc, XCB_GC_FOREGROUND, &vals[1]);
-    rect.width = bar_.box[BAR_WS].w / cfg_.num_workspaces;
-    rect.height = bar_.h;
-    rect.x = bar_.box[BAR_WS].x + rect.width * idx;
-    rect.y = 0;
-    xcb_poly_fill_rectangle(nil_.con, bar_.win, bar_.gc, 1, &rect);
+}
 
-    /* text */
-    xcb_change_gc(nil_.con, bar_.gc, XCB_GC_FOREGROUND | XCB_GC_BACKGROUND, vals);
-    len = snprintf(text, sizeof(text), "%u", idx + 1);
-    rect.x += CENTER_H_(rect.width, cal_text_width(text, len));
-    rect.y += CENTER_V_(rect.height);
-    xcb_image_text_8(nil_.con, len, bar_.win, bar_.gc, rect.x, rect.y, text);
+/** Show a status produced without X, see poll_bar_status
+ * The root WM_NAME is ignored from now on.
+ */
+void set_bar_status(const char *s, unsigned int len) {
+    status_direct_ = 1;
+    if (reserve_text(&fetch_, len) != 0) {
+        return;
+    }
+    memcpy(fetch_.s, s, len);
+    fetch_.s[len] = '\0';
+    fetch_.len = len;
+    status_stale_ = 1;
 }
 
-void update_bar_sym() {
-    const char *sym;
+/** Keep the last complete line written to the status FIFO
+ * It is shown by poll_bar_status, lines written meanwhile are skipped. Lines
+ * longer than MAX_LINE_ are dropped up to their newline. At most a line is
+ * read per wakeup, the watch is level triggered and comes back for the rest
+ * while a writer keeps the FIFO full.
+ */
+static
+void read_bar_status(struct watch_t *self) {
+    ssize_t n;
+    unsigned int i, start, line, len;
 
-    sym = (get_layout(&nil_.ws[nil_.ws_idx]))->symbol;
-    if (!sym) {
-        NIL_ERR("no layout symbol %d", nil_.ws_idx);
+    do {
+        if (reserve_text(&input_, input_.len + READ_SIZE_) != 0) {
+            input_.len = 0;
+            input_skip_ = 1;
+            return;
+        }
+        n = read(self->fd, input_.s + input_.len, READ_SIZE_);
+        if (n > 0) {
+            input_.len += n;
+        }
+    } while ((n == READ_SIZE_) && (input_.len <= MAX_LINE_));
+    line = len = 0;
+    for (i = start = 0; i < input_.len; ++i) {
+        if (input_.s[i] != '\n') {
+            continue;
+        }
+        if (input_skip_) {              /* end of a dropped line */
+            input_skip_ = 0;
+        } else if (i - start > MAX_LINE_) {
+            NIL_ERR("status line %u", i - start);
+        } else {
+            line = start;
+            len = i - start + 1;        /* with its newline, 0 if none */
+        }
+        start = i + 1;
+    }
+    if (len > 0) {
+        set_bar_status(input_.s + line, len - 1);
+    }
+    /* keep the beginning of the next line */
+    input_.len -= start;
+    if (!input_skip_ && (input_.len > MAX_LINE_)) {
+        NIL_ERR("status line %u", input_.len);
+        input_skip_ = 1;
+    }
+    if (input_skip_) {
+        input_.len = 0;
+    }
+    memmove(input_.s, input_.s + start, input_.len);
+}
+
+/** Read the status from cfg_.status_fifo instead of the root WM_NAME
+ * The FIFO is created if needed. It is also opened for writing, so that
+ * writers may come and go without an end of file. It is not opened when
+ * status modules are configured, they own the status.
+ */
+void open_bar_status() {
+    if (!cfg_.status_fifo || (cfg_.modules_len > 0)) {
         return;
     }
-    draw_bar_text(&bar_.box[BAR_SYM], sym, strlen(sym));
+    if ((mkfifo(cfg_.status_fifo, 0600) != 0) && (errno != EEXIST)) {
+        NIL_ERR("mkfifo %s %d", cfg_.status_fifo, errno);
+        return;
+    }
+    status_watch_.fd = open(cfg_.status_fifo, O_RDWR | O_NONBLOCK | O_CLOEXEC);
+    if (status_watch_.fd < 0) {
+        NIL_ERR("open %s %d", cfg_.status_fifo, errno);
+        return;
+    }
+    status_watch_.func = &read_bar_status;
+    if (add_watch(&status_watch_) != 0) {
+        close(status_watch_.fd);
+        status_watch_.fd = -1;
+        return;
+    }
+    /* shown until the first line */
+    status_direct_ = 1;
+    if (fetch_default_status() == 0) {
+        status_stale_ = 1;
+    }
 }
 
-void update_bar_status() {
-    int len;
-    len = get_text_prop(nil_.scr->root, XCB_ATOM_WM_NAME, status_, sizeof(status_));
-    if (len <= 0) {
-        len = strlen(STATUS_TEXT_);
-        memcpy(status_, STATUS_TEXT_, len);
-        status_[len] = '\0';
+/** Read the status reply, then fetch again if it changed meanwhile
+ * Called once at the end of each events batch. Fetches, or lines taken from
+ * the FIFO, are at least cfg_.status_interval apart and each one redraws the
+ * status at most once.
+ * @return 0 while the reply is awaited, else ms until the next fetch may be
+ * sent, -1 if none is waiting
+ */
+int poll_bar_status() {
+    unsigned long elapsed;
+    int ret;
+
+    if (status_seq_) {
+        ret = (*nil_.be->poll_text_property)(status_seq_, &fetch_);
+        if (ret == 0) {
+            return 0;
+        }
+        ++stats_.replies;
+        status_seq_ = 0;
+        if ((ret > 0) || (fetch_default_status() == 0)) {
+            set_status();
+        }
+    }
+    if (!status_stale_) {
+        return -1;
+    }
+    elapsed = now_us() / 1000 - status_time_;
+    if (elapsed < cfg_.status_interval) {
+        return (int)(cfg_.status_interval - elapsed);
+    }
+    status_stale_ = 0;
+    status_time_ = now_us() / 1000;
+    if (status_direct_) {               /* the text is already there */
+        set_status();
+        return -1;
+    }
+    status_seq_ = (*nil_.be->query_text_property)(nil_.scr->root,
+        XCB_ATOM_WM_NAME);
+    return 0;
+}
+
+/** The title of a client changed or it is gone, redraw it if shown
+ */
+void update_bar_task(struct client_t *c) {
+    if (c == task_) {
+        task_ = 0;
+        NIL_SET_FLAG(bar_.box[BAR_TASK].flags, BOX_DIRTY);
     }
-    draw_bar_text(&bar_.box[BAR_STATUS], status_, len);
+}
+
+/** Redraw the marked boxes, then copy the changed span to the window
+ * Called once at the end of each events batch.
+ */
+void draw_bar() {
+    struct bar_box_t *box;
+    struct client_t *c;
+    xcb_rectangle_t rect;
+    unsigned int i;
+    int x;
+
+    for (i = ws_lo_; i <= ws_hi_ && i < cfg_.num_workspaces; ++i) {
+        draw_bar_ws(i);
+    }
+    ws_lo_ = 1;
+    ws_hi_ = 0;
+    box = &bar_.box[BAR_SYM];
+    if (NIL_HAS_FLAG(box->flags, BOX_DIRTY)) {
+        NIL_CLEAR_FLAG(box->flags, BOX_DIRTY);
+        draw_bar_sym();
+    }
+    box = &bar_.box[BAR_STATUS];
+    if (NIL_HAS_FLAG(box->flags, BOX_DIRTY)) {
+        NIL_CLEAR_FLAG(box->flags, BOX_DIRTY);
+        x = box->x;
+        draw_bar_status();
+        if (box->x != x) {      /* the task box is resized */
+            NIL_SET_FLAG(bar_.box[BAR_TASK].flags, BOX_DIRTY);
+        }
+    }
+    /* the focused client is compared, focus changes need no update */
+    box = &bar_.box[BAR_TASK];
+    c = nil_.ws[nil_.ws_idx].focus;
+    if (NIL_HAS_FLAG(box->flags, BOX_DIRTY) || (c != task_)) {
+        NIL_CLEAR_FLAG(box->flags, BOX_DIRTY);
+        task_ = c;
+        draw_bar_task();
+    }
+    if (damage_x1_ < 0) {
+        damage_x1_ = 0;
+    }
+    if (damage_x2_ > bar_.w) {
+        damage_x2_ = bar_.w;
+    }
+    if (damage_x1_ >= damage_x2_) {
+        return;
+    }
+    rect.x = damage_x1_;
+    rect.y = 0;
+    rect.width = damage_x2_ - damage_x1_;
+    rect.height = bar_.h;
+    damage_x1_ = damage_x2_ = 0;
+    (*nil_.be->copy_area)(bar_.pixmap, bar_.win,
+        bar_.scheme[SCHEME_NORMAL].fill, &rect);
+}
+
+void cleanup_bar() {
+    del_watch(&status_watch_);
+    status_direct_ = 0;
+    free(status_.s);
+    free(fetch_.s);
+    free(input_.s);
+    memset(&status_, 0, sizeof(status_));
+    memset(&fetch_, 0, sizeof(fetch_));
+    memset(&input_, 0, sizeof(input_));
+    input_skip_ = 0;
+    status_seq_ = 0;
+    task_ = 0;
 }
 
 /* vim: set ts=4 sw=4 expandtab: */
@@ -0,0 +1,325 @@
+/*
+ * Nilwm - Lightweight X window manager.
+ * See LICENSE file for copyright and license details.
+ */
+
+/* Microbenchmarks of the data path, run against the mock backend.
+ * One line per result: name, size, ns/op, X requests/op, round trips/op.
+ * The screen grows with the number of clients so that every tile keeps at
+ * least 1px, it is 1920x1080 up to 354 clients.
+ */
+
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include "nilwm.h"
+
+#define NUM_WORKSPACES_     9
+#define MAX_KEYS_           4096
+#define MIN_TIME_NS_        50000000UL      /* run each case at least 50ms */
+#define WIN_BASE_           0x200000        /* first client window id */
+#define CONTAINER_BASE_     0x100000        /* workspace containers */
+#define KEYSYM_BASE_        0x1000000       /* keysyms of filler keys */
+#define KEYCODE_            38
+#define SCREEN_W_           1920
+#define SCREEN_H_           1080
+#define BAR_H_              16
+#define TILE_H_             3               /* 1px tall with its borders */
+
+static struct key_t keys_[MAX_KEYS_];
+static struct workspace_t ws_[NUM_WORKSPACES_];
+static xcb_screen_t screen_;
+static volatile unsigned long sink_;
+static unsigned int size_;          /* size of the current case */
+
+/* only fields used by the data path */
+const struct config_t cfg_ = {
+    .mod_key = XCB_MOD_MASK_4,
+    .border_width = 1,
+    .num_workspaces = NUM_WORKSPACES_,
+    .keys = keys_,
+    .keys_len = MAX_KEYS_,
+    .master_size = 55,
+    .motion_interval = 16,
+};
+
+static
+unsigned long now_ns() {
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (unsigned long)ts.tv_sec * 1000000000 + ts.tv_nsec;
+}
+
+static
+void nop_key(const struct arg_t *arg) {
+    sink_ += arg->u;
+}
+
+/** Run a case until it takes long enough, then print its line
+ */
+static
+void run(const char *name, unsigned int n, void (*func)(unsigned int i)) {
+    unsigned long iters, i, start, ns, reqs, trips;
+
+    size_ = n;
+    (*func)(0);     /* warm up */
+    for (iters = 1; ; iters *= 2) {
+        mock_clear_requests();
+        trips = stats_.round_trips;
+        start = now_ns();
+        for (i = 0; i < iters; ++i) {
+            (*func)(i);
+        }
+        ns = now_ns() - start;
+        if (ns >= MIN_TIME_NS_) {
+            break;
+        }
+    }
+    reqs = mock_num_requests();
+    trips = stats_.round_trips - trips;
+    printf("%-20s %6u %12.1f %10.2f %8.2f\n", name, n, (double)ns / iters,
+        (double)reqs / iters, (double)trips / iters);
+    fflush(stdout);
+}
+
+/** Remove every client of a workspace
+ */
+static
+void clear_ws(struct workspace_t *ws) {
+    struct client_t *c;
+
+    while (ws->first) {
+        c = ws->first;
+        detach_client(c);
+        free_client(c);
+    }
+    ws->focus = 0;
+    ws->flags = 0;
+}
+
+static
+void add_client(struct workspace_t *ws, xcb_window_t win) {
+    struct client_t *c;
+
+    c = alloc_client(win);
+    if (!c) {
+        exit(1);
+    }
+    c->border_width = cfg_.border_width;
+    NIL_SET_FLAG(c->flags, CLIENT_DISPLAY | CLIENT_MAPPED);
+    attach_client(c, ws);
+    ws->focus = c;
+}
+
+/** Put n displayed clients on a workspace, removing previous ones
+ */
+static
+void fill_ws(struct workspace_t *ws, unsigned int n, xcb_window_t base) {
+    unsigned int i;
+
+    clear_ws(ws);
+    for (i = 0; i < n; ++i) {
+        add_client(ws, base + i);
+    }
+}
+
+static
+void bench_arrange(unsigned int i) {
+    /* every client moves */
+    ws_[0].master_size = (i & 1) ? 50 : 60;
+    arrange_ws(&ws_[0]);
+}
+
+static
+void bench_arrange_settled(unsigned int NIL_UNUSED(i)) {
+    arrange_ws(&ws_[0]);
+}
+
+/** The server would answer with a FocusIn, follow it here
+ * Monocle sets the focus by itself.
+ */
+static
+void bench_focus(unsigned int NIL_UNUSED(i)) {
+    struct workspace_t *ws;
+    struct arg_t arg;
+
+    ws = &ws_[0];
+    arg.i = NAV_NEXT;
+    focus(&arg);
+    if (ws->layout != LAYOUT_MONO) {
+        set_focus(ws, ws->focus->next ? ws->focus->next : ws->first);
+    }
+}
+
+static
+void bench_swap(unsigned int NIL_UNUSED(i)) {
+    struct arg_t arg;
+
+    arg.i = NAV_NEXT;
+    swap(&arg);
+}
+
+/** Drag the last client onto the master
+ */
+static
+void bench_move(unsigned int NIL_UNUSED(i)) {
+    struct workspace_t *ws;
+    struct mouse_event_t e;
+
+    ws = &ws_[0];
+    e.mode = CURSOR_MOVE;
+    e.client = ws->last;
+    e.ws = ws;
+    e.x1 = e.x2 = ws->first->x + 1;
+    e.y1 = e.y2 = ws->first->y + 1;
+    (*get_layout(ws)->move)(ws, &e);
+    settle_ws();
+}
+
+/** Drag the master boundary back and forth
+ */
+static
+void bench_resize(unsigned int i) {
+    struct workspace_t *ws;
+    struct mouse_event_t e;
+
+    ws = &ws_[0];
+    e.mode = CURSOR_RESIZE;
+    e.client = ws->first;
+    e.ws = ws;
+    e.x1 = e.x2 = nil_.w * ((i & 1) ? 40 : 60) / 100;
+    e.y1 = e.y2 = nil_.h / 2;
+    (*get_layout(ws)->resize)(ws, &e);
+    settle_ws();
+}
+
+static
+void bench_change_ws(unsigned int NIL_UNUSED(i)) {
+    struct arg_t arg;
+
+    arg.u = !nil_.ws_idx;
+    change_ws(&arg);
+    settle_ws();
+    draw_bar();
+}
+
+static
+void bench_find(unsigned int i) {
+    struct workspace_t *ws;
+
+    /* spread lookups over all clients */
+    sink_ += (unsigned long)find_client(WIN_BASE_
+        + (i * 2654435761u) % size_, &ws);
+}
+
+static
+void bench_find_miss(unsigned int i) {
+    sink_ += (unsigned long)find_client(WIN_BASE_ / 2 + i % size_, 0);
+}
+
+/** The keymap always has MAX_KEYS_ keys, the size is the place of the key
+ */
+static
+void bench_check_key(unsigned int NIL_UNUSED(i)) {
+    sink_ += check_key(0, KEYSYM_BASE_ + size_ - 1);
+}
+
+static
+void bench_check_key_miss(unsigned int NIL_UNUSED(i)) {
+    sink_ += check_key(0, XCB_NO_SYMBOL);
+}
+
+static
+void bench_get_keysym(unsigned int i) {
+    sink_ += get_keysym(KEYCODE_, (i & 1) ? XCB_MOD_MASK_SHIFT : 0);
+}
+
+/** Make the screen tall enough for a stack of n tiles
+ */
+static
+void size_screen(unsigned int n) {
+    nil_.h = SCREEN_H_ - BAR_H_;
+    if (n * TILE_H_ > nil_.h) {
+        nil_.h = n * TILE_H_;
+    }
+    screen_.height_in_pixels = nil_.y + nil_.h;
+}
+
+/** Set up a workspace of n clients for a layout and run a case on it
+ */
+static
+void run_ws(const char *name, unsigned int layout, unsigned int n,
+    void (*func)(unsigned int)) {
+    size_screen(n);
+    nil_.ws_idx = 0;
+    ws_[0].layout = layout;
+    ws_[0].master_size = cfg_.master_size;
+    fill_ws(&ws_[0], n, WIN_BASE_);
+    arrange_ws(&ws_[0]);
+    run(name, n, func);
+}
+
+int main() {
+    static const unsigned int sizes[] = { 1, 10, 100, 1000, 10000 };
+    static const unsigned int key_places[] = { 16, 64, 256, 1024, 4096 };
+    unsigned int i, j, n;
+
+    nil_.be = &backend_mock_;
+    screen_.width_in_pixels = SCREEN_W_;
+    nil_.scr = &screen_;
+    nil_.x = 0;
+    nil_.y = BAR_H_;
+    nil_.w = SCREEN_W_;
+    size_screen(0);
+    nil_.ws = ws_;
+    for (i = 0; i < NUM_WORKSPACES_; ++i) {
+        ws_[i].master_size = cfg_.master_size;
+        ws_[i].win = CONTAINER_BASE_ + i;
+    }
+    for (i = 0; i < MAX_KEYS_; ++i) {
+        keys_[i].keysym = KEYSYM_BASE_ + i;
+        keys_[i].func = &nop_key;
+        keys_[i].arg.u = 1;
+    }
+    mock_set_keysym(KEYCODE_, 0, 'a');
+    mock_set_keysym(KEYCODE_, 1, 'A');
+
+    printf("# name                   n        ns/op     req/op  rtt/op\n");
+    for (i = 0; i < NIL_LEN(sizes); ++i) {
+        n = sizes[i];
+        run_ws("arrange_tile", LAYOUT_TILE, n, &bench_arrange);
+        run_ws("arrange_tile_settled", LAYOUT_TILE, n, &bench_arrange_settled);
+        run_ws("focus_tile", LAYOUT_TILE, n, &bench_focus);
+        run_ws("swap_tile", LAYOUT_TILE, n, &bench_swap);
+        run_ws("move_tile", LAYOUT_TILE, n, &bench_move);
+        run_ws("resize_tile", LAYOUT_TILE, n, &bench_resize);
+        run_ws("focus_mono", LAYOUT_MONO, n, &bench_focus);
+        /* same number of clients on both workspaces */
+        fill_ws(&ws_[1], n, WIN_BASE_ + n);
+        run_ws("change_ws", LAYOUT_TILE, n, &bench_change_ws);
+        clear_ws(&ws_[1]);
+    }
+    for (i = 0; i < NIL_LEN(sizes); ++i) {
+        n = sizes[i];
+        /* clients spread over all workspaces */
+        for (j = 0; j < n; ++j) {
+            add_client(&ws_[j % NUM_WORKSPACES_], WIN_BASE_ + j);
+        }
+        run("find_client", n, &bench_find);
+        run("find_client_miss", n, &bench_find_miss);
+        for (j = 0; j < NUM_WORKSPACES_; ++j) {
+            clear_ws(&ws_[j]);
+        }
+    }
+    for (i = 0; i < NIL_LEN(key_places); ++i) {
+        run("check_key_at", key_places[i], &bench_check_key);
+    }
+    run("check_key_miss", MAX_KEYS_, &bench_check_key_miss);
+    run("get_keysym", 1, &bench_get_keysym);
+    cleanup_clients();
+    mock_reset();
+    return 0;
+}
+
+/* vim: set ts=4 sw=4 expandtab: */
@@ -5,73 +5,193 @@
 
 #include <stdlib.h>
 #include <stddef.h>
+#include <string.h>
 #include "nilwm.h"
 
-/** Initialize a client after having window
- * @note client_t.win must be set previously.
- */
-void init_client(struct client_t *self) {
-    xcb_size_hints_t sz;
-    xcb_get_property_cookie_t cookie;
-
-    if (self->w == 0 || self->h == 0) {         /* get window geometry */
-        xcb_get_geometry_reply_t *geo;
-        geo = xcb_get_geometry_reply(nil_.con,
-            xcb_get_geometry(nil_.con, self->win), 0);
-        if (geo) {
-            self->x = geo->x;
-            self->y = geo->y;
-            self->w = geo->width;
-            self->h = geo->height;
-            free(geo);
-        } else {
-            self->x = 0;
-            self->y = 0;
-            self->w = nil_.scr->width_in_pixels;
-            self->h = nil_.scr->height_in_pixels;
+#define INDEX_BITS_         6       /* initial number of buckets (log2) */
+#define SLAB_SIZE_          64      /* clients per slab */
+
+/* clients are allocated by slab, never freed until cleanup */
+struct slab_t {
+    struct slab_t *next;
+    struct client_t clients[SLAB_SIZE_];
+};
+
+/* window to client index, chained through client_t.hash_next */
+static struct client_t **index_;
+static unsigned int index_bits_;
+static unsigned int index_len_;
+
+static struct slab_t *slabs_;
+static struct client_t *free_;      /* free clients chained through next */
+
+/* title fetch waiting for its reply, see poll_titles */
+struct title_fetch_t {
+    xcb_window_t win;
+    unsigned int seq;
+};
+
+static struct title_fetch_t *fetches_;
+static unsigned int fetches_head_;  /* next reply to read */
+static unsigned int fetches_len_;
+static unsigned int fetches_size_;
+static struct client_t *titles_;    /* marked by mark_title */
+static unsigned long titles_time_;  /* of the last batch (ms) */
+static struct text_t title_;        /* last reply, swapped into the client */
+
+/** Get a zeroed client from the pool
+ */
+struct client_t *alloc_client(xcb_window_t win) {
+    struct client_t *c;
+    struct slab_t *slab;
+    unsigned int i;
+
+    if (!free_) {
+        slab = malloc(sizeof(struct slab_t));
+        if (!slab) {
+            NIL_ERR("out of mem %d", win);
+            return 0;
+        }
+        slab->next = slabs_;
+        slabs_ = slab;
+        for (i = 0; i < SLAB_SIZE_; ++i) {
+            slab->clients[i].next = free_;
+            free_ = &slab->clients[i];
         }
-        NIL_LOG("client x=%d y=%d w=%d h=%d", self->x, self->y, self->w, self->h);
-    }
-    /* get size hints */
-    cookie = xcb_icccm_get_wm_normal_hints_unchecked(nil_.con, self->win);
-    if (!xcb_icccm_get_wm_normal_hints_reply(nil_.con, cookie, &sz, 0)) {
-        NIL_LOG("no normal hints %d", cookie.sequence);
-        self->min_w = self->min_h = self->max_w = self->max_h = 0;
-        self->flags = 0;
+    }
+    c = free_;
+    free_ = c->next;
+    memset(c, 0, sizeof(struct client_t));
+    c->win = win;
+    return c;
+}
+
+/** Take a client out of the focus history of its workspace
+ */
+static
+void unlink_mru(struct client_t *self) {
+    if (!self->mru_prev) {
         return;
     }
-    if (NIL_HAS_FLAG(sz.flags, XCB_ICCCM_SIZE_HINT_P_MIN_SIZE)) {
-        self->min_w = sz.min_width;
-        self->min_h = sz.min_height;
-    } else {
-        self->min_w = self->min_h = 0;
+    if (self->mru_next) {
+        self->mru_next->mru_prev = self->mru_prev;
     }
-    if (NIL_HAS_FLAG(sz.flags, XCB_ICCCM_SIZE_HINT_P_MAX_SIZE)) {
-        self->max_w = sz.max_width;
-        self->max_h = sz.max_height;
-    } else {
-        self->max_w = self->max_h = 0;
+    *(self->mru_prev) = self->mru_next;
+    self->mru_next = 0;
+    self->mru_prev = 0;
+}
+
+/** Take a client out of both focus histories
+ */
+static
+void forget_focus(struct client_t *self) {
+    unlink_mru(self);
+    if (!self->gmru_prev) {
+        return;
+    }
+    if (self->gmru_next) {
+        self->gmru_next->gmru_prev = self->gmru_prev;
+    }
+    *(self->gmru_prev) = self->gmru_next;
+    self->gmru_next = 0;
+    self->gmru_prev = 0;
+}
+
+/** Take a client out of the marked titles
+ */
+static
+void unmark_title(struct client_t *self) {
+    if (!NIL_HAS_FLAG(self->flags, CLIENT_TITLE)) {
+        return;
+    }
+    if (self->title_next) {
+        self->title_next->title_prev = self->title_prev;
+    }
+    *(self->title_prev) = self->title_next;
+    self->title_next = 0;
+    self->title_prev = 0;
+    NIL_CLEAR_FLAG(self->flags, CLIENT_TITLE);
+}
+
+/** Give a detached client back to the pool
+ */
+void free_client(struct client_t *self) {
+    forget_focus(self);
+    unmark_title(self);
+    update_bar_task(self);
+    free(self->title.s);
+    memset(&self->title, 0, sizeof(self->title));
+    self->next = free_;
+    free_ = self;
+}
+
+/** Initialize a client from the replies of backend_t.query_window
+ * @note client_t.win must be set previously. The caller accounts for the
+ * round trip, as replies of many windows may be read at once.
+ * @return -1 if the window must not be managed
+ */
+int init_client(struct client_t *self, struct client_query_t *q) {
+    struct window_info_t info;
+
+    if ((*nil_.be->read_window)(q, &info) != 0 || info.override_redirect) {
+        NIL_LOG("not managed %d", self->win);
+        free(info.title);
+        return -1;
+    }
+    self->map_state = info.map_state;
+    /* window geometry */
+    if (info.has_geom) {
+        self->geom = info.geom;
+        self->x = info.geom.x;
+        self->y = info.geom.y;
+        self->w = info.geom.w;
+        self->h = info.geom.h;
+    } else if (self->w == 0 || self->h == 0) {
+        self->x = 0;
+        self->y = 0;
+        self->w = nil_.scr->width_in_pixels;
+        self->h = nil_.scr->height_in_pixels;
     }
-    self->flags = 0;
+    NIL_LOG("client x=%d y=%d w=%d h=%d", self->x, self->y, self->w, self->h);
+    /* a managed window mapped again keeps its pending title fetch */
+    self->flags &= CLIENT_TITLE | CLIENT_NET_NAME;
+    if (info.net_name) {
+        NIL_SET_FLAG(self->flags, CLIENT_NET_NAME);
+    }
+    if (info.wm_delete) {
+        NIL_SET_FLAG(self->flags, CLIENT_DELETE);
+    }
+    if (info.title) {
+        free(self->title.s);
+        self->title.s = info.title;
+        self->title.len = strlen(info.title);
+        self->title.size = self->title.len + 1;
+    }
+    /* size hints */
+    self->min_w = info.min_w;
+    self->min_h = info.min_h;
+    self->max_w = info.max_w;
+    self->max_h = info.max_h;
     if ((self->min_w && self->max_w && (self->min_w == self->max_w))
         || (self->min_h && self->max_h && (self->min_h == self->max_h))) {
         NIL_SET_FLAG(self->flags, CLIENT_FLOAT | CLIENT_FIXED); /* force float */
     }
     NIL_LOG("hints min=%u,%u max=%u,%u flag=%u", self->min_w, self->min_h,
         self->max_w, self->max_h, self->flags);
+    return 0;
 }
 
 void config_client(struct client_t *self) {
     uint32_t vals[2];
     vals[0] = self->border_width;
     vals[1] = XCB_STACK_MODE_ABOVE;
-    xcb_configure_window(nil_.con, self->win, XCB_CONFIG_WINDOW_BORDER_WIDTH
+    (*nil_.be->configure_window)(self->win, XCB_CONFIG_WINDOW_BORDER_WIDTH
         | XCB_CONFIG_WINDOW_STACK_MODE, vals);
     vals[0] = nil_.color.border;
-    xcb_change_window_attributes(nil_.con, self->win, XCB_CW_BORDER_PIXEL, vals);
+    (*nil_.be->change_window_attributes)(self->win, XCB_CW_BORDER_PIXEL, vals);
     vals[0] = XCB_EVENT_MASK_ENTER_WINDOW | XCB_EVENT_MASK_FOCUS_CHANGE
         | XCB_EVENT_MASK_PROPERTY_CHANGE | XCB_EVENT_MASK_SUBSTRUCTURE_NOTIFY;
-    xcb_change_window_attributes(nil_.con, self->win, XCB_CW_EVENT_MASK, vals);
+    (*nil_.be->change_window_attributes)(self->win, XCB_CW_EVENT_MASK, vals);
 }
 
 int check_client_size(struct client_t *self) {
@@ -95,16 +215,108 @@ int check_client_size(struct client_t *self) {
     return ret;
 }
 
+/** Send the wanted geometry, only fields which differ from the server's
+ */
 void update_client_geom(struct client_t *self) {
     uint32_t vals[4];
-    vals[0] = self->x;
-    vals[1] = self->y;
-    vals[2] = self->w;
-    vals[3] = self->h;
-    xcb_configure_window(nil_.con, self->win,
-        XCB_CONFIG_WINDOW_X | XCB_CONFIG_WINDOW_Y
-        | XCB_CONFIG_WINDOW_WIDTH | XCB_CONFIG_WINDOW_HEIGHT,
-        vals);
+    uint16_t mask;
+    unsigned int n;
+
+    mask = 0;
+    n = 0;
+    if (self->x != self->geom.x) {
+        mask |= XCB_CONFIG_WINDOW_X;
+        vals[n++] = self->x;
+    }
+    if (self->y != self->geom.y) {
+        mask |= XCB_CONFIG_WINDOW_Y;
+        vals[n++] = self->y;
+    }
+    if (self->w != self->geom.w) {
+        mask |= XCB_CONFIG_WINDOW_WIDTH;
+        vals[n++] = self->w;
+    }
+    if (self->h != self->geom.h) {
+        mask |= XCB_CONFIG_WINDOW_HEIGHT;
+        vals[n++] = self->h;
+    }
+    if (mask == 0) {
+        return;
+    }
+    (*nil_.be->configure_window)(self->win, mask, vals);
+    self->geom.x = self->x;
+    self->geom.y = self->y;
+    self->geom.w = self->w;
+    self->geom.h = self->h;
+}
+
+/** Bucket of a window in the index
+ * Window ids mostly differ in low bits, multiply to spread them.
+ */
+static NIL_INLINE
+unsigned int index_hash(xcb_window_t win) {
+    return (uint32_t)(win * 2654435761u) >> (32 - index_bits_);
+}
+
+/** Double the number of buckets, keep the old ones if out of memory
+ */
+static
+void grow_index() {
+    struct client_t **buckets, *c, *next;
+    unsigned int i, size;
+
+    size = 1 << index_bits_;
+    buckets = calloc(size * 2, sizeof(struct client_t *));
+    if (!buckets) {
+        NIL_ERR("out of mem %u", size * 2);
+        return;
+    }
+    ++index_bits_;
+    for (i = 0; i < size; ++i) {
+        for (c = index_[i]; c; c = next) {
+            next = c->hash_next;
+            c->hash_next = buckets[index_hash(c->win)];
+            buckets[index_hash(c->win)] = c;
+        }
+    }
+    free(index_);
+    index_ = buckets;
+}
+
+static
+void index_client(struct client_t *self) {
+    unsigned int i;
+
+    if (!index_) {
+        index_ = calloc(1 << INDEX_BITS_, sizeof(struct client_t *));
+        if (!index_) {
+            NIL_ERR("out of mem %d", self->win);
+            return;
+        }
+        index_bits_ = INDEX_BITS_;
+    } else if (index_len_ >= (1u << index_bits_)) {
+        grow_index();
+    }
+    i = index_hash(self->win);
+    self->hash_next = index_[i];
+    index_[i] = self;
+    ++index_len_;
+}
+
+static
+void unindex_client(struct client_t *self) {
+    struct client_t **p;
+
+    if (!index_) {
+        return;
+    }
+    for (p = &index_[index_hash(self->win)]; *p; p = &(*p)->hash_next) {
+        if (*p == self) {
+            *p = self->hash_next;
+            --index_len_;
+            return;
+        }
+    }
 }
 
 /** Add a client to the first position of client list
@@ -118,58 +330,151 @@ void attach_client(struct client_t *self, struct workspace_t *ws) {
         ws->last = self;
     }
     ws->first = self;
+    self->ws = ws;
+    index_client(self);
 }
 
-/** Client should be in the workspace
+/** Take a client out of the list of its workspace, it stays indexed
  */
-void detach_client(struct client_t *self) {
+static
+void unlink_client(struct client_t *self) {
+    struct workspace_t *ws;
+
+    ws = self->ws;
     if (self->next) {
         self->next->prev = self->prev;
-    } else {                        /* list is empty, no more last element */
-        /* Using container_of macro. See http://en.wikipedia.org/wiki/Offsetof */
-        struct workspace_t *ws = (struct workspace_t *)
-            ((char *)(self->prev) - offsetof(struct workspace_t, first));
+    } else if (self->prev == &ws->first) {  /* list is empty */
         ws->last = 0;
+    } else {                        /* previous one is the last now */
+        /* Using container_of macro. See http://en.wikipedia.org/wiki/Offsetof */
+        ws->last = (struct client_t *)
+            ((char *)(self->prev) - offsetof(struct client_t, next));
     }
     *(self->prev) = self->next;
 }
 
+/** Client should be in the workspace
+ * It leaves the focus history of the workspace, not the global one.
+ */
+void detach_client(struct client_t *self) {
+    unlink_client(self);
+    unindex_client(self);
+    unlink_mru(self);
+    if (self->ws->cycle == self) {
+        self->ws->cycle = 0;
+    }
+}
+
+/** Move a client before another one of its workspace, at the end if 0
+ * Only the links change, the client keeps its window and state.
+ */
+void move_client(struct client_t *self, struct client_t *before) {
+    struct workspace_t *ws;
+
+    if (self == before) {
+        return;
+    }
+    ws = self->ws;
+    unlink_client(self);
+    self->next = before;
+    if (before) {
+        self->prev = before->prev;
+        before->prev = &self->next;
+    } else {
+        self->prev = ws->last ? &ws->last->next : &ws->first;
+        ws->last = self;
+    }
+    *(self->prev) = self;
+}
+
+/** Find a managed client by its window in constant time
+ */
 struct client_t *find_client(xcb_window_t win, struct workspace_t **ws) {
     struct client_t *c;
-    unsigned int i;
 
-    /* search in current workspace first :) */
-    for (i = nil_.ws_idx; i < cfg_.num_workspaces; --i) {
-        for (c = nil_.ws[i].first; c; c = c->next) {
-            if (c->win == win) {
-                if (ws) {
-                    *ws = &nil_.ws[i];
-                }
-                return c;
-            }
-        }
+    if (!index_) {
+        return 0;
     }
-    for (i = nil_.ws_idx + 1; i < cfg_.num_workspaces; ++i) {
-        for (c = nil_.ws[i].first; c; c = c->next) {
-            if (c->win == win) {
-                if (ws) {
-                    *ws = &nil_.ws[i];
-                }
-                return c;
+    for (c = index_[index_hash(win)]; c; c = c->hash_next) {
+        if (c->win == win) {
+            if (ws) {
+                *ws = c->ws;
             }
+            return c;
         }
     }
     return 0;
 }
 
-/** Swap window, keep other properties
+/** Release the index and all clients
+ */
+void cleanup_clients() {
+    struct slab_t *slab;
+    unsigned int i;
+
+    free(index_);
+    index_ = 0;
+    index_len_ = 0;
+    nil_.mru = 0;
+    for (i = 0; i < cfg_.num_workspaces; ++i) {
+        nil_.ws[i].mru = 0;
+        nil_.ws[i].cycle = 0;
+        while (nil_.ws[i].first) {
+            free(nil_.ws[i].first->title.s);
+            nil_.ws[i].first = nil_.ws[i].first->next;
+        }
+    }
+    while (slabs_) {
+        slab = slabs_;
+        slabs_ = slab->next;
+        free(slab);
+    }
+    free_ = 0;
+    free(fetches_);
+    free(title_.s);
+    fetches_ = 0;
+    fetches_head_ = fetches_len_ = fetches_size_ = 0;
+    titles_ = 0;
+    memset(&title_, 0, sizeof(title_));
+}
+
+/** Put a client first in the focus histories, it must be attached
+ */
+void touch_client(struct client_t *self) {
+    struct workspace_t *ws;
+
+    forget_focus(self);
+    ws = self->ws;
+    self->mru_next = ws->mru;
+    self->mru_prev = &ws->mru;
+    if (ws->mru) {
+        ws->mru->mru_prev = &self->mru_next;
+    }
+    ws->mru = self;
+    self->gmru_next = nil_.mru;
+    self->gmru_prev = &nil_.mru;
+    if (nil_.mru) {
+        nil_.mru->gmru_prev = &self->gmru_next;
+    }
+    nil_.mru = self;
+}
+
+/** Exchange the places of two clients of a workspace
  */
 void swap_client(struct client_t *self, struct client_t *c) {
-    xcb_window_t win;
+    struct client_t *next;
 
-    win = self->win;
-    self->win = c->win;
-    c->win = win;
+    next = self->next;
+    if (next == c) {
+        move_client(c, self);
+        return;
+    }
+    if (c->next == self) {
+        move_client(self, c);
+        return;
+    }
+    move_client(self, c->next);
+    move_client(c, next);
 }
 
 /** Change border color
@@ -178,7 +483,7 @@ void focus_client(struct client_t *self) {
     uint32_t vals[1];
 
     vals[0] = nil_.color.focus;
-    xcb_change_window_attributes(nil_.con, self->win, XCB_CW_BORDER_PIXEL, vals);
+    (*nil_.be->change_window_attributes)(self->win, XCB_CW_BORDER_PIXEL, vals);
     NIL_SET_FLAG(self->flags, CLIENT_FOCUS);
 }
 
@@ -188,21 +493,130 @@ void blur_client(struct client_t *self) {
     uint32_t vals[1];
 
     vals[0] = nil_.color.border;
-    xcb_change_window_attributes(nil_.con, self->win, XCB_CW_BORDER_PIXEL, vals);
+    (*nil_.be->change_window_attributes)(self->win, XCB_CW_BORDER_PIXEL, vals);
     NIL_CLEAR_FLAG(self->flags, CLIENT_FOCUS);
 }
 
 void raise_client(struct client_t *self) {
     const uint32_t vals[] = { XCB_STACK_MODE_ABOVE };
-    xcb_configure_window(nil_.con, self->win, XCB_CONFIG_WINDOW_STACK_MODE, vals);
+    (*nil_.be->configure_window)(self->win, XCB_CONFIG_WINDOW_STACK_MODE, vals);
 }
 
 void hide_client(struct client_t *self) {
-    xcb_unmap_window(nil_.con, self->win);
+    (*nil_.be->unmap_window)(self->win);
 }
 
 void show_client(struct client_t *self) {
-    xcb_map_window(nil_.con, self->win);
+    (*nil_.be->map_window)(self->win);
+}
+
+/** Move a client into the container of a workspace
+ * The container is at the origin of the screen, the position is unchanged.
+ */
+void reparent_client(struct client_t *self, struct workspace_t *ws) {
+    (*nil_.be->reparent_window)(self->win, ws->win, self->geom.x,
+        self->geom.y);
+}
+
+/** The title of a client changed, it is fetched by the next poll_titles
+ */
+void mark_title(struct client_t *self) {
+    if (NIL_HAS_FLAG(self->flags, CLIENT_TITLE)) {
+        return;
+    }
+    NIL_SET_FLAG(self->flags, CLIENT_TITLE);
+    self->title_next = titles_;
+    self->title_prev = &titles_;
+    if (titles_) {
+        titles_->title_prev = &self->title_next;
+    }
+    titles_ = self;
+}
+
+/** Keep the fetched title if it differs
+ */
+static
+void set_title(struct client_t *self) {
+    struct text_t t;
+
+    if ((title_.len == self->title.len) && ((title_.len == 0)
+        || (memcmp(title_.s, self->title.s, title_.len) == 0))) {
+        return;
+    }
+    t = self->title;
+    self->title = title_;
+    title_ = t;
+    update_bar_task(self);
+}
+
+/** Ask for the title of a marked client, it is unmarked
+ * @return -1 if out of memory, the client stays marked
+ */
+static
+int fetch_title(struct client_t *self) {
+    struct title_fetch_t *p;
+    unsigned int n;
+
+    if (fetches_len_ >= fetches_size_) {
+        n = fetches_size_ ? fetches_size_ * 2 : 16;
+        p = realloc(fetches_, n * sizeof(struct title_fetch_t));
+        if (!p) {
+            NIL_ERR("out of mem %u", n);
+            return -1;
+        }
+        fetches_ = p;
+        fetches_size_ = n;
+    }
+    unmark_title(self);
+    fetches_[fetches_len_].win = self->win;
+    fetches_[fetches_len_].seq = (*nil_.be->query_text_property)(self->win,
+        NIL_HAS_FLAG(self->flags, CLIENT_NET_NAME) ? nil_.atom.net_wm_name
+        : XCB_ATOM_WM_NAME);
+    ++fetches_len_;
+    return 0;
+}
+
+/** Read the title replies, then fetch the marked titles in one batch
+ * Called at the end of each events batch. A batch is sent once all replies
+ * of the previous one are read and at least cfg_.title_interval after it,
+ * so a client renaming itself on each key press costs one request per
+ * interval and no round trip.
+ * @return 0 while replies are awaited, else ms until the next batch may be
+ * sent, -1 if none is waiting
+ */
+int poll_titles() {
+    struct client_t *c;
+    unsigned long now, elapsed;
+    int ret;
+
+    for (; fetches_head_ < fetches_len_; ++fetches_head_) {
+        ret = (*nil_.be->poll_text_property)(fetches_[fetches_head_].seq,
+            &title_);
+        if (ret == 0) {
+            return 0;
+        }
+        ++stats_.replies;
+        c = find_client(fetches_[fetches_head_].win, 0);
+        if (c && ret > 0) {
+            set_title(c);
+        }
+    }
+    fetches_head_ = fetches_len_ = 0;
+    if (!titles_) {
+        return -1;
+    }
+    now = now_us() / 1000;
+    elapsed = now - titles_time_;
+    if (elapsed < cfg_.title_interval) {
+        return (int)(cfg_.title_interval - elapsed);
+    }
+    titles_time_ = now;
+    while (titles_) {
+        if (fetch_title(titles_) != 0) {
+            break;
+        }
+    }
+    return (fetches_len_ > 0) ? 0 : -1;
 }
 
 /* vim: set ts=4 sw=4 expandtab: */
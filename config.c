@@ -17,7 +17,14 @@ const struct config_t cfg_ = {
     .keys_len = NIL_LEN(KEYS),
 
     .master_size = MASTER_SIZE,
+    .motion_interval = MOTION_INTERVAL,
+    .status_interval = STATUS_INTERVAL,
+    .title_interval = TITLE_INTERVAL,
     .font_name = FONT_NAME,
+    .stats_file = STATS_FILE,
+    .status_fifo = STATUS_FIFO,
+    .modules = MODULES,
+    .modules_len = NIL_LEN(MODULES),
 
     .border_color = BORDER_COLOR,
     .focus_color = FOCUS_COLOR,
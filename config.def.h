@@ -14,6 +14,9 @@
 #define BORDER_WIDTH        1
 #define NUM_WORKSPACES      9
 #define MASTER_SIZE         55      /* % */
+#define MOTION_INTERVAL     16      /* ms between move/resize updates */
+#define STATUS_INTERVAL     100     /* ms between status bar updates */
+#define TITLE_INTERVAL      200     /* ms between window title fetches */
 
 #define BORDER_COLOR        "blue"
 #define FOCUS_COLOR         "red"
@@ -25,8 +28,22 @@
 
 #define FONT_NAME           "-*-fixed-medium-r-normal-*-13-*-*-*-*-*-iso10646-*"
 
+#define STATS_FILE          0       /* e.g. "/tmp/nilwm.stats", 0 for stderr */
+#define STATUS_FIFO         0       /* e.g. "/tmp/nilwm.status", 0 for WM_NAME,
+                                     * unused with MODULES */
+
 static const char *CMD_TERM[] = { "xterm", 0 };
 
+/* built-in status, replaces STATUS_FIFO and WM_NAME if not empty */
+static const struct module_t MODULES[] = {
+    /* function         interval (ms)   argument */
+/*  { status_cpu,       2000,           0 }, */
+/*  { status_mem,       5000,           0 }, */
+/*  { status_battery,   30000,          "BAT0" }, */
+/*  { status_net,       2000,           "eth0" }, */
+/*  { status_clock,     1000,           "%a %d %b %H:%M" }, */
+};
+
 #define KEY_WS_(KEY, NUM)   \
     { MOD_KEY,                      KEY,            change_ws,          {.u = NUM} }, \
     { MOD_KEY|MOD_SHIFT,            KEY,            push,               {.u = NUM} },
@@ -38,10 +55,13 @@ static const struct key_t KEYS[] = {
     { MOD_KEY,                      XK_Return,      focus,              {.i =  0} },
     { MOD_KEY,                      XK_j,           focus,              {.i = +1} },
     { MOD_KEY,                      XK_k,           focus,              {.i = -1} },
+    { MOD_KEY,                      XK_Tab,         cycle,              {.i =  0} },
+    { MOD_KEY,                      XK_BackSpace,   focus_last,         {.i =  0} },
     { MOD_KEY,                      XK_l,           set_msize,          {.i = +5} },
     { MOD_KEY,                      XK_h,           set_msize,          {.i = -5} },
     { MOD_KEY,                      XK_t,           set_layout,         {.i =  0} },
     { MOD_KEY,                      XK_f,           set_layout,         {.i =  1} },
+    { MOD_KEY,                      XK_m,           set_layout,         {.i =  2} },
     { MOD_KEY,                      XK_space,       set_layout,         {.i = -1} },
     { MOD_KEY|MOD_SHIFT,            XK_Return,      swap,               {.i =  0} },
     { MOD_KEY|MOD_SHIFT,            XK_j,           swap,               {.i = +1} },
@@ -4,28 +4,107 @@
  */
 
 #include <stdlib.h>
+#include <stdint.h>
+#include <errno.h>
+#include <time.h>
+#include <unistd.h>
+#include <signal.h>
+#include <sys/wait.h>
+#include <sys/epoll.h>
+#include <sys/signalfd.h>
+#include <sys/timerfd.h>
 #include "nilwm.h"
 
 #define MOD_MASK_(state)    ((state) & ~(nil_.mask_numlock | XCB_MOD_MASK_LOCK))
+#define MAX_EPOLL_EVENTS_   8
 
 static struct mouse_event_t mouse_evt_;
+static int motion_pending_;             /* latest pointer position not applied */
+static unsigned long motion_time_;      /* when a drag was last applied (ms) */
+
+static int epoll_fd_ = -1;
+static int running_;
+static struct watch_t x_watch_         = { .fd = -1 };  /* X connection */
+static struct watch_t signal_watch_    = { .fd = -1 };  /* signalfd */
+static struct watch_t motion_timer_    = { .fd = -1 };  /* deferred drag update */
+static struct watch_t status_timer_    = { .fd = -1 };  /* deferred status fetch */
+static struct watch_t title_timer_     = { .fd = -1 };  /* deferred title fetch */
+static int fetching_;                   /* title or status reply awaited */
+
+/** Apply the latest pointer position to the dragged client
+ */
+static
+void drag_client() {
+    const struct layout_t *h;
+
+    h = get_layout(mouse_evt_.ws);
+    switch (mouse_evt_.mode) {
+    case CURSOR_MOVE:
+        if (h->move) {
+            (*h->move)(mouse_evt_.ws, &mouse_evt_);
+        }
+        break;
+    case CURSOR_RESIZE:
+        if (h->resize) {
+            (*h->resize)(mouse_evt_.ws, &mouse_evt_);
+        }
+        break;
+    }
+    /* this position has been applied */
+    mouse_evt_.x1 = mouse_evt_.x2;
+    mouse_evt_.y1 = mouse_evt_.y2;
+    motion_pending_ = 0;
+    motion_time_ = now_us() / 1000;
+}
+
+/** Milliseconds until the pending motion may be applied, -1 if none
+ */
+static
+int motion_delay() {
+    unsigned long elapsed;
+
+    if (!motion_pending_) {
+        return -1;
+    }
+    elapsed = now_us() / 1000 - motion_time_;
+    if (elapsed >= cfg_.motion_interval) {
+        return 0;
+    }
+    return (int)(cfg_.motion_interval - elapsed);
+}
+
+/** Stop dragging and release the pointer
+ */
+static
+void end_drag() {
+    mouse_evt_.mode = CURSOR_NORMAL;
+    mouse_evt_.client = 0;
+    motion_pending_ = 0;
+    (*nil_.be->ungrab_pointer)();
+}
 
 static
 void handle_key_press(xcb_key_press_event_t *e) {
     xcb_keysym_t sym;
     NIL_LOG("event: key press %d %d", e->state, e->detail);
 
-    sym = xcb_key_symbols_get_keysym(nil_.key_syms, e->detail, 0);
+    sym = (*nil_.be->lookup_keysym)(e->detail, 0);
     /* find key with *LOCK state removed */
-    if (check_key(MOD_MASK_(e->state), sym)) {
-        xcb_flush(nil_.con);
-        return;
-    }
+    check_key(MOD_MASK_(e->state), sym);
 }
 
+/** Releasing a modifier ends cycling the focus history
+ */
 static
 void handle_key_release(xcb_key_release_event_t *e) {
+    struct workspace_t *ws;
+
     NIL_LOG("event: key release %d %d", e->state, e->detail);
+    ws = &nil_.ws[nil_.ws_idx];
+    if (NIL_HAS_FLAG(ws->flags, WS_CYCLE)
+        && xcb_is_modifier_key((*nil_.be->lookup_keysym)(e->detail, 0))) {
+        end_cycle(ws);
+    }
 }
 
 /** Handle the ButtonPress event
@@ -36,9 +115,7 @@ void handle_button_press(xcb_button_press_event_t *e) {
         e->detail, e->event, e->child, e->event_x, e->event_y);
 
     if (e->event == bar_.win) {
-        if (click_bar(e->event_x)) {
-            xcb_flush(nil_.con);
-        }
+        click_bar(e->event_x);
         return;
     }
     /* click on client with modkey */
@@ -52,11 +129,11 @@ void handle_button_press(xcb_button_press_event_t *e) {
         switch (e->detail) {
         case XCB_BUTTON_INDEX_3:
             mouse_evt_.mode = CURSOR_RESIZE;
-            /* warp pointer to lower right */
+            /* warp pointer to lower right (relative to the client) */
             mouse_evt_.x1 = mouse_evt_.client->x + mouse_evt_.client->w;
             mouse_evt_.y1 = mouse_evt_.client->y + mouse_evt_.client->h;
-            xcb_warp_pointer(nil_.con, XCB_NONE, mouse_evt_.client->win,
-                0, 0, 0, 0, mouse_evt_.x1, mouse_evt_.y1);
+            (*nil_.be->warp_pointer)(mouse_evt_.client->win,
+                mouse_evt_.client->w, mouse_evt_.client->h);
             break;
         case XCB_BUTTON_INDEX_1:
         default:
@@ -65,52 +142,45 @@ void handle_button_press(xcb_button_press_event_t *e) {
             mouse_evt_.y1 = e->event_y;
             break;
         }
+        mouse_evt_.x2 = mouse_evt_.x1;
+        mouse_evt_.y2 = mouse_evt_.y1;
+        motion_pending_ = 0;
+        motion_time_ = 0;
         /* take control of the pointer in the root window */
-        xcb_grab_pointer(nil_.con, 0, nil_.scr->root,
-            XCB_EVENT_MASK_BUTTON_RELEASE | XCB_EVENT_MASK_BUTTON_MOTION,
-            XCB_GRAB_MODE_ASYNC, XCB_GRAB_MODE_ASYNC, XCB_NONE,
-            nil_.cursor[mouse_evt_.mode], XCB_CURRENT_TIME);
-        xcb_flush(nil_.con);
+        (*nil_.be->grab_pointer)(nil_.cursor[mouse_evt_.mode]);
         return;
     }
 end:
     /* if unhandled, forward the click to the application */
-    xcb_allow_events(nil_.con, XCB_ALLOW_REPLAY_POINTER, e->time);
+    (*nil_.be->allow_events)(XCB_ALLOW_REPLAY_POINTER, e->time);
 }
 
 static
 void handle_button_release(xcb_button_release_event_t *e) {
-    const struct layout_t *h;
-
     NIL_LOG("event: mouse release %d", e->detail);
+    if (!mouse_evt_.client) {
+        return;
+    }
+    /* the final position is always applied */
     mouse_evt_.x2 = e->event_x;
     mouse_evt_.y2 = e->event_y;
-
-    h = get_layout(mouse_evt_.ws);
-    switch (mouse_evt_.mode) {
-    case CURSOR_MOVE:
-        if (h->move) {
-            (*h->move)(mouse_evt_.ws, &mouse_evt_);
-        }
-        break;
-    case CURSOR_RESIZE:
-        if (h->resize) {
-            (*h->resize)(mouse_evt_.ws, &mouse_evt_);
-        }
-        break;
-    }
-    xcb_ungrab_pointer(nil_.con, XCB_CURRENT_TIME);
-    xcb_flush(nil_.con);
+    drag_client();
+    end_drag();
 }
 
 /** Mouse moved
+ * Only the latest position is kept, it is applied at the end of the batch.
  */
 static
 void handle_motion_notify(xcb_motion_notify_event_t *e) {
     NIL_LOG("event: mouse motion %d,%d", e->event_x, e->event_y);
 
+    if (!mouse_evt_.client) {
+        return;
+    }
     mouse_evt_.x2 = e->event_x;
     mouse_evt_.y2 = e->event_y;
+    motion_pending_ = 1;
 }
 
 /** Mouse entered
@@ -134,7 +204,6 @@ void handle_enter_notify(xcb_enter_notify_event_t *e) {
         }
         focus_client(c);
         ws->focus = c;
-        xcb_flush(nil_.con);
     }
 #endif
 }
@@ -154,18 +223,10 @@ void handle_focus_in(xcb_focus_in_event_t *e) {
     }
     c = find_client(e->event, &ws);
     if (!c) {
-        NIL_ERR("no client %d", e->event);
+        NIL_LOG("not managed %d", e->event);
         return;
     }
-    if (c == ws->focus) {
-        return;
-    }
-    if (ws->focus) {
-        blur_client(ws->focus);
-    }
-    focus_client(c);
-    ws->focus = c;
-    xcb_flush(nil_.con);
+    set_focus(ws, c);
 }
 
 /** Blured
@@ -175,51 +236,17 @@ void handle_focus_out(xcb_focus_out_event_t *e) {
     NIL_LOG("event: focus out win=%d", e->event);
 }
 
-/** This handler just for status bar initialization.
+/** Show the exposed part of the bar again from its pixmap
  */
 static
 void handle_expose(xcb_expose_event_t *e) {
     NIL_LOG("event: expose win=%d %d,%d %ux%u", e->window, e->x, e->y, e->width,
         e->height);
 
-    if (e->window == bar_.win) {            /* init bar */
-        NIL_LOG("bar draw seq=%u", e->sequence);
-        if (e->count == 0) {
-            config_bar();
-            update_bar_ws(nil_.ws_idx);
-            update_bar_sym();
-            update_bar_status();
-            xcb_flush(nil_.con);
-        }
-        return;
-    }
-}
-
-/** Handler for creating a new window
- * xterm size request is 1x1?
- */
-static
-void handle_create_notify(xcb_create_notify_event_t *e) {
-    struct client_t *c;
-
-    NIL_LOG("event: create notify win=%d par=%d @ %d,%d %ux%u", e->window,
-        e->parent, e->x, e->y, e->width, e->height);
-    if (e->override_redirect) {
-        return;
-    }
-    c = malloc(sizeof(struct client_t));
-    if (!c) {
-        NIL_ERR("out of mem %d", e->window);
+    if (e->window == bar_.win) {
+        expose_bar(e->x, e->width);
         return;
     }
-    c->win = e->window;
-    c->x = e->x;
-    c->y = e->y;
-    c->w = e->width;
-    c->h = e->height;
-    c->border_width = e->border_width;
-    /* add into current workspace and re-arrange */
-    attach_client(c, &nil_.ws[nil_.ws_idx]);
 }
 
 /** Handler for destroying a window
@@ -232,21 +259,22 @@ void handle_destroy_notify(xcb_destroy_notify_event_t *e) {
     NIL_LOG("event: destroy notify win=%d", e->window);
     c = find_client(e->window, &ws);
     if (!c) {
-        NIL_ERR("no client %d", e->window);
+        NIL_LOG("not managed %d", e->window);
         return;
     }
+    if (c == mouse_evt_.client) {
+        end_drag();
+    }
     detach_client(c);
     if (!NIL_HAS_FLAG(c->flags, CLIENT_FLOAT)) {
-        /* rearrange if is current workspace */
-        if (ws == &nil_.ws[nil_.ws_idx]) {
-            arrange_ws(ws);
-            xcb_flush(nil_.con);
-        }
+        mark_ws(ws);
     }
     if (ws->focus == c) {
-        ws->focus = 0;
+        restore_focus(ws);
+        /* monocle shows the new one */
+        mark_ws(ws);
     }
-    free(c);
+    free_client(c);
 }
 
 static
@@ -256,7 +284,7 @@ void handle_unmap_notify(xcb_unmap_notify_event_t *e) {
     NIL_LOG("event: unmap notify %d", e->window);
     c = find_client(e->window, 0);
     if (!c) {
-        NIL_ERR("no client %d", e->window);
+        NIL_LOG("not managed %d", e->window);
         return;
     }
     NIL_CLEAR_FLAG(c->flags, CLIENT_MAPPED);
@@ -272,13 +300,14 @@ void handle_map_notify(xcb_map_notify_event_t *e) {
     }
     c = find_client(e->window, 0);
     if (!c) {
-        NIL_ERR("no client %d", e->window);
+        NIL_LOG("not managed %d", e->window);
         return;
     }
     NIL_SET_FLAG(c->flags, CLIENT_MAPPED);
 }
 
 /** Handler for changing position, size
+ * Keep the geometry cache in sync with the server.
  */
 static
 void handle_configure_notify(xcb_configure_notify_event_t *e) {
@@ -291,79 +320,88 @@ void handle_configure_notify(xcb_configure_notify_event_t *e) {
     if (e->window == nil_.scr->root) {
         return;
     }
-#if 0
-    c = find_client(e->window);
+    c = find_client(e->window, 0);
     if (!c) {
-        NIL_ERR("no client %d", e->window);
+        NIL_LOG("not managed %d", e->window);
         return;
     }
-    /* update client's geometry */
-    c->x = e->x;
-    c->y = e->y;
-    /* invalidate pixmap if resized */
-    if (c->w != e->width || c->h != e->height
-        || c->border_width != e->border_width) {
-    }
-    c->w = e->width;
-    c->h = e->height;
-    c->border_width = e->border_width;
-    /* restack */
-#else
-    (void)c;
-#endif
+    c->geom.x = e->x;
+    c->geom.y = e->y;
+    c->geom.w = e->width;
+    c->geom.h = e->height;
 }
 
 static
 void handle_map_request(xcb_map_request_event_t *e) {
-    xcb_get_window_attributes_reply_t *reply;
+    struct client_query_t q;
     struct client_t *c;
     struct workspace_t *ws;
+    int is_new;
 
     NIL_LOG("event: map request win=%d", e->window);
-    reply = xcb_get_window_attributes_reply(nil_.con,
-        xcb_get_window_attributes_unchecked(nil_.con, e->window), 0);
-    if (!reply) {
-        NIL_ERR("no reply %d", e->window);
-        return;
+    /* all replies are collected at once */
+    (*nil_.be->query_window)(e->window, &q);
+    c = find_client(e->window, &ws);
+    is_new = !c;
+    if (is_new) {           /* first time it is mapped */
+        c = alloc_client(e->window);
+        if (!c) {
+            (*nil_.be->discard_window)(&q);
+            return;
+        }
+        ws = &nil_.ws[nil_.ws_idx];
     }
-    if (reply->override_redirect) {
-        NIL_ERR("override_redirect %d", e->window);
-        free(reply);
+    if (NIL_REPLY(init_client(c, &q)) != 0) {
+        if (is_new) {
+            free_client(c);
+        }
         return;
     }
-    free(reply);
-    c = find_client(e->window, &ws);
-    if (!c) {
-        NIL_ERR("no client %d", e->window);
-        return;
+    if (is_new) {
+        attach_client(c, ws);
+        /* back to the root if the wm dies */
+        (*nil_.be->change_save_set)(XCB_SET_MODE_INSERT, c->win);
+        reparent_client(c, ws);
     }
-    init_client(c);
     NIL_SET_FLAG(c->flags, CLIENT_DISPLAY);
     if (!NIL_HAS_FLAG(c->flags, CLIENT_FLOAT)) {
         /* only rearrange if it's not float */
-        arrange_ws(ws);
+        mark_ws(ws);
     }
     if (check_client_size(c)) {             /* fix window size if needed */
         update_client_geom(c);
     }
     config_client(c);
-    if (ws == &nil_.ws[nil_.ws_idx]) {
-        xcb_map_window(nil_.con, c->win);
-        xcb_set_input_focus(nil_.con, XCB_INPUT_FOCUS_POINTER_ROOT, c->win,
-            XCB_CURRENT_TIME);
-    }
-    xcb_flush(nil_.con);
+    /* mapped by settle_ws once it has its place, or when ws is shown */
+    NIL_SET_FLAG(c->flags, CLIENT_PENDING);
+    NIL_SET_FLAG(ws->flags, WS_PENDING);
+    end_phase(PHASE_FIRST_WINDOW);
 }
 
 static
 void handle_property_notify(xcb_property_notify_event_t *e) {
+    struct client_t *c;
+
     NIL_LOG("event: property notify win=%d atom=%d", e->window, e->atom);
 
     if (e->atom == XCB_ATOM_WM_NAME && e->window == nil_.scr->root) {
         update_bar_status();
-        xcb_flush(nil_.con);
         return;
     }
+    if (e->atom != XCB_ATOM_WM_NAME && e->atom != nil_.atom.net_wm_name) {
+        return;
+    }
+    c = find_client(e->window, 0);
+    if (!c) {
+        return;
+    }
+    /* once set, _NET_WM_NAME is preferred */
+    if (e->atom == nil_.atom.net_wm_name) {
+        NIL_SET_FLAG(c->flags, CLIENT_NET_NAME);
+    } else if (NIL_HAS_FLAG(c->flags, CLIENT_NET_NAME)) {
+        return;
+    }
+    mark_title(c);
 }
 
 typedef void (*event_handler_t)(xcb_generic_event_t *);
@@ -377,7 +415,6 @@ static const event_handler_t HANDLERS_[] = {
     [XCB_FOCUS_IN]          = (event_handler_t)&handle_focus_in,
     [XCB_FOCUS_OUT]         = (event_handler_t)&handle_focus_out,
     [XCB_EXPOSE]            = (event_handler_t)&handle_expose,
-    [XCB_CREATE_NOTIFY]     = (event_handler_t)&handle_create_notify,
     [XCB_DESTROY_NOTIFY]    = (event_handler_t)&handle_destroy_notify,
     [XCB_UNMAP_NOTIFY]      = (event_handler_t)&handle_unmap_notify,
     [XCB_MAP_NOTIFY]        = (event_handler_t)&handle_map_notify,
@@ -386,20 +423,297 @@ static const event_handler_t HANDLERS_[] = {
     [XCB_PROPERTY_NOTIFY]   = (event_handler_t)&handle_property_notify,
 };
 
+/** Dispatch an event to its handler
+ */
+static
+void dispatch_event(xcb_generic_event_t *e) {
+    unsigned int type;
+    unsigned long start;
+
+    type = e->response_type & ~0x80;
+    if (type < NIL_LEN(HANDLERS_) && HANDLERS_[type] != 0) {
+        start = now_us();
+        (*HANDLERS_[type])(e);
+        record_event(type, now_us() - start);
+    } else {
+        NIL_LOG("event: unknown type %u", type);
+    }
+}
+
+/** Drain and handle all events available on the X connection
+ */
+static
+unsigned int recv_x_events(xcb_generic_event_t *e) {
+    unsigned int n;
+
+    if (!e) {
+        e = (*nil_.be->poll_event)();
+    }
+    n = 0;
+    while (e) {
+        dispatch_event(e);
+        /* Free the Generic Event */
+        free(e);
+        ++n;
+        e = (*nil_.be->poll_event)();
+    }
+    stats_.events += n;
+    if (n > stats_.max_batch) {
+        stats_.max_batch = n;
+    }
+    NIL_LOG("batch events=%u (total events=%lu wakeups=%lu)", n,
+        stats_.events, stats_.wakeups);
+    return n;
+}
+
+static
+void handle_signal(struct watch_t *self) {
+    struct signalfd_siginfo si;
+
+    while (read(self->fd, &si, sizeof(si)) == sizeof(si)) {
+        NIL_LOG("signal %u", si.ssi_signo);
+        switch (si.ssi_signo) {
+        case SIGCHLD:
+            while (0 < waitpid(-1, 0, WNOHANG)) {
+            }
+            break;
+        case SIGTERM:
+            stop_events();
+            break;
+        case SIGUSR1:
+            write_stats();
+            break;
+        }
+    }
+}
+
+static
+void handle_motion_timer(struct watch_t *NIL_UNUSED(self)) {
+    if (motion_pending_) {
+        drag_client();
+    }
+}
+
+/** Only wakes the loop, the status and titles are fetched at the end of the
+ * iteration
+ */
+static
+void handle_fetch_timer(struct watch_t *NIL_UNUSED(self)) {
+}
+
+/** Register a file descriptor in the events loop
+ */
+int add_watch(struct watch_t *w) {
+    struct epoll_event ev;
+
+    ev.events = EPOLLIN;
+    ev.data.ptr = w;
+    if (epoll_ctl(epoll_fd_, EPOLL_CTL_ADD, w->fd, &ev) != 0) {
+        NIL_ERR("epoll_ctl add %d", w->fd);
+        return -1;
+    }
+    return 0;
+}
+
+/** Unregister and close a file descriptor
+ */
+void del_watch(struct watch_t *w) {
+    if (w->fd < 0) {
+        return;
+    }
+    epoll_ctl(epoll_fd_, EPOLL_CTL_DEL, w->fd, 0);
+    close(w->fd);
+    w->fd = -1;
+}
+
+/** Create a disarmed timer, see set_timer
+ */
+int add_timer(struct watch_t *w) {
+    w->fd = timerfd_create(CLOCK_MONOTONIC, TFD_NONBLOCK | TFD_CLOEXEC);
+    if (w->fd < 0) {
+        NIL_ERR("timerfd_create %d", errno);
+        return -1;
+    }
+    NIL_SET_FLAG(w->flags, WATCH_TIMER);
+    return add_watch(w);
+}
+
+/** Arm a timer to expire after value ms then every interval ms
+ * Zero value disarms it, zero interval makes it one-shot.
+ */
+void set_timer(struct watch_t *w, unsigned int value, unsigned int interval) {
+    struct itimerspec its;
+
+    its.it_value.tv_sec = value / 1000;
+    its.it_value.tv_nsec = (value % 1000) * 1000000;
+    its.it_interval.tv_sec = interval / 1000;
+    its.it_interval.tv_nsec = (interval % 1000) * 1000000;
+    timerfd_settime(w->fd, 0, &its, 0);
+}
+
+/** Set up epoll with the X connection, signals and timers
+ */
+int init_loop() {
+    sigset_t mask;
+
+    epoll_fd_ = epoll_create1(EPOLL_CLOEXEC);
+    if (epoll_fd_ < 0) {
+        NIL_ERR("epoll_create %d", errno);
+        return -1;
+    }
+    x_watch_.fd = (*nil_.be->get_fd)();
+    if (add_watch(&x_watch_) != 0) {
+        return -1;
+    }
+    /* signals are only received from signalfd */
+    sigemptyset(&mask);
+    sigaddset(&mask, SIGCHLD);
+    sigaddset(&mask, SIGTERM);
+    sigaddset(&mask, SIGUSR1);
+    sigprocmask(SIG_BLOCK, &mask, 0);
+    signal_watch_.fd = signalfd(-1, &mask, SFD_NONBLOCK | SFD_CLOEXEC);
+    if (signal_watch_.fd < 0) {
+        NIL_ERR("signalfd %d", errno);
+        return -1;
+    }
+    signal_watch_.func = &handle_signal;
+    if (add_watch(&signal_watch_) != 0) {
+        return -1;
+    }
+    motion_timer_.func = &handle_motion_timer;
+    if (add_timer(&motion_timer_) != 0) {
+        return -1;
+    }
+    status_timer_.func = &handle_fetch_timer;
+    if (add_timer(&status_timer_) != 0) {
+        return -1;
+    }
+    title_timer_.func = &handle_fetch_timer;
+    if (add_timer(&title_timer_) != 0) {
+        return -1;
+    }
+    return 0;
+}
+
+void cleanup_loop() {
+    if (epoll_fd_ < 0) {
+        return;
+    }
+    del_watch(&title_timer_);
+    del_watch(&status_timer_);
+    del_watch(&motion_timer_);
+    del_watch(&signal_watch_);
+    /* X connection is closed by xcb_disconnect */
+    close(epoll_fd_);
+    epoll_fd_ = -1;
+}
+
+/** Make recv_events return after the current iteration
+ */
+void stop_events() {
+    running_ = 0;
+}
+
+/** Read the title and status replies, send the next fetches
+ * A reply read from the socket by xcb meanwhile, e.g. while flushing, no
+ * longer wakes epoll, so the loop polls again before sleeping while
+ * fetching_ is set.
+ */
+static
+void poll_fetches() {
+    int delay;
+
+    delay = poll_titles();
+    if (delay > 0) {
+        set_timer(&title_timer_, delay, 0);
+    }
+    fetching_ = (delay == 0);
+    delay = poll_bar_status();
+    if (delay > 0) {
+        set_timer(&status_timer_, delay, 0);
+    }
+    fetching_ |= (delay == 0);
+}
+
 /** Events loop
+ * Sleep in epoll until the X connection, a signal or a timer is ready. In each
+ * iteration signals are handled first, then all queued X events, then timers,
+ * and requests are flushed once at the end.
  */
 void recv_events() {
+    struct epoll_event evs[MAX_EPOLL_EVENTS_];
+    struct watch_t *w;
     xcb_generic_event_t *e;
-    unsigned int type;
-    while ((e = xcb_wait_for_event(nil_.con))) {
-        type = e->response_type & ~0x80;
-        if (type < NIL_LEN(HANDLERS_) && HANDLERS_[type] != 0) {
-            (*HANDLERS_[type])(e);
-        } else {
-            NIL_LOG("event: unknown type %u", type);
+    uint64_t expired;
+    unsigned long replies;
+    int i, n, has_x, delay, timeout;
+
+    start_stats();
+    running_ = 1;
+    while (running_) {
+        /* xcb may already hold events read while waiting for a reply */
+        e = (*nil_.be->poll_queued_event)();
+        timeout = e ? 0 : -1;
+        if (!e && fetching_) {          /* or replies */
+            replies = stats_.replies;
+            poll_fetches();
+            if (stats_.replies != replies) {
+                timeout = 0;
+            }
         }
-        /* Free the Generic Event */
-        free(e);
+        n = epoll_wait(epoll_fd_, evs, NIL_LEN(evs), timeout);
+        if (n < 0) {
+            if (errno == EINTR) {
+                n = 0;
+            } else {
+                NIL_ERR("epoll_wait %d", errno);
+                free(e);
+                break;
+            }
+        }
+        ++stats_.wakeups;
+        has_x = (e != 0);
+        for (i = 0; i < n; ++i) {
+            w = evs[i].data.ptr;
+            if (w == &x_watch_) {
+                has_x = 1;
+            } else if (w == &signal_watch_) {
+                handle_signal(w);
+            }
+        }
+        if (has_x) {
+            recv_x_events(e);
+        }
+        for (i = 0; i < n; ++i) {
+            w = evs[i].data.ptr;
+            if ((w == &x_watch_) || (w == &signal_watch_)) {
+                continue;
+            }
+            if (NIL_HAS_FLAG(w->flags, WATCH_TIMER)
+                && (read(w->fd, &expired, sizeof(expired)) != sizeof(expired))) {
+                continue;   /* re-armed or disarmed meanwhile */
+            }
+            (*w->func)(w);
+        }
+        /* apply drag now or when the frame interval has passed */
+        delay = motion_delay();
+        if (delay == 0) {
+            drag_client();
+        } else if (delay > 0) {
+            set_timer(&motion_timer_, delay, 0);
+        }
+        settle_ws();
+        poll_fetches();
+        draw_bar();
+        if ((*nil_.be->has_error)()) {
+            NIL_ERR("X connection error %d", (*nil_.be->has_error)());
+            break;
+        }
+        (*nil_.be->flush)();
+        ++stats_.flushes;
     }
+    NIL_LOG("loop events=%lu wakeups=%lu flushes=%lu max batch=%u",
+        stats_.events, stats_.wakeups, stats_.flushes,
+        stats_.max_batch);
 }
 /* vim: set ts=4 sw=4 expandtab: */
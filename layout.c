@@ -7,6 +7,7 @@
 
 #define SYMBOL_TILE_            "T"
 #define SYMBOL_FREE_            "F"
+#define SYMBOL_MONO_            "M"
 
 #define RESIZE_CLIENT_(C, X, Y, W, H)       \
     C->x = X; C->y = Y;                     \
@@ -19,15 +20,14 @@
     for (C = FROM; C != *C->prev; C = *C->prev) {   \
         if (COND) { break; }                \
     }
-#define EACH_CLIENT_(WS, C, CMD)            \
-    C = WS->first;                          \
-    while (C) {                             \
-        CMD(C);                             \
-        C = C->next;                        \
-    }
 #define CAN_TILE_(C)     (NIL_HAS_FLAG(C->flags, CLIENT_DISPLAY)   \
     && !NIL_HAS_FLAG(C->flags, CLIENT_FLOAT))
 #define CAN_FOCUS_(C)    (NIL_HAS_FLAG(C->flags, CLIENT_DISPLAY))
+#define HAS_POINT_(C, X, Y)     ((X) >= C->x && (Y) >= C->y         \
+    && (X) < C->x + C->w + 2 * C->border_width                     \
+    && (Y) < C->y + C->h + 2 * C->border_width)
+#define MIN_MASTER_SIZE_        5
+#define MAX_MASTER_SIZE_        95
 
 /** Tile windows
  * Not arrange floating window
@@ -83,10 +83,10 @@ void arrange_tile(struct workspace_t *self) {
     } while (0 != (c = c->next));
 }
 
-/** Focus next window in tile mode
+/** Find the client to be focused next
  */
 static
-void focus_tile(struct workspace_t *self, const int dir) {
+struct client_t *next_focus(struct workspace_t *self, const int dir) {
     struct client_t *c;
 
     if (!self->focus) {
@@ -113,13 +113,50 @@ void focus_tile(struct workspace_t *self, const int dir) {
     } else {
         NEXT_CLIENT_(c, self->first, CAN_FOCUS_(c));
     }
+    return c;
+}
+
+/** Give the input focus to a client, the FocusIn event marks it focused
+ */
+static
+void select_tile(struct workspace_t *NIL_UNUSED(self), struct client_t *c) {
+    (*nil_.be->set_input_focus)(c->win);
+    raise_client(c);
+}
+
+/** Focus next window in tile mode
+ */
+static
+void focus_tile(struct workspace_t *self, const int dir) {
+    struct client_t *c;
+
+    c = next_focus(self, dir);
     if (c) {
-        xcb_set_input_focus(nil_.con, XCB_INPUT_FOCUS_POINTER_ROOT, c->win,
-            XCB_CURRENT_TIME);
-        raise_client(c);
+        select_tile(self, c);
     }
 }
 
+/** Exchange the wanted geometry of two clients
+ */
+static
+void swap_geom(struct client_t *a, struct client_t *b) {
+    int16_t x, y;
+    uint16_t w, h;
+
+    x = a->x;
+    y = a->y;
+    w = a->w;
+    h = a->h;
+    a->x = b->x;
+    a->y = b->y;
+    a->w = b->w;
+    a->h = b->h;
+    b->x = x;
+    b->y = y;
+    b->w = w;
+    b->h = h;
+}
+
 /** Only swap with tiled windows
  */
 static
@@ -152,23 +189,13 @@ void swap_tile(struct workspace_t *self, const int dir) {
     }
     if (c && c != self->focus) {
         swap_client(self->focus, c);
+        /* each one takes the place of the other */
+        swap_geom(c, self->focus);
         update_client_geom(c);
         update_client_geom(self->focus);
     }
 }
 
-static
-void move_tile(struct workspace_t *self, struct mouse_event_t *e) {
-    (void)self;
-    (void)e;
-}
-
-static
-void resize_tile(struct workspace_t *self, struct mouse_event_t *e) {
-    (void)self;
-    (void)e;
-}
-
 static
 void move_free(struct workspace_t *self, struct mouse_event_t *e) {
     struct client_t *c;
@@ -195,6 +222,132 @@ void resize_free(struct workspace_t *self, struct mouse_event_t *e) {
     update_client_geom(c);
 }
 
+/** Drop the dragged client at the place of the tiled client under pointer
+ * The list is reordered by moving one node, clients between them shift by
+ * one place when the workspace is arranged. Floating clients move freely.
+ */
+static
+void move_tile(struct workspace_t *self, struct mouse_event_t *e) {
+    struct client_t *c;
+    int after;
+
+    if (!CAN_TILE_(e->client)) {
+        move_free(self, e);
+        return;
+    }
+    after = 0;
+    for (c = self->first; c; c = c->next) {
+        if (c == e->client) {
+            after = 1;
+        } else if (CAN_TILE_(c) && HAS_POINT_(c, e->x2, e->y2)) {
+            break;
+        }
+    }
+    if (!c) {
+        return;
+    }
+    /* dragged down goes after the target, up goes before it */
+    move_client(e->client, after ? c->next : c);
+    mark_ws(self);
+}
+
+/** Drag the master/stack boundary with the right edge of the master
+ * The master size follows the pointer, only clients whose geometry changes
+ * are configured when the workspace is arranged. Floating clients are
+ * resized freely.
+ */
+static
+void resize_tile(struct workspace_t *self, struct mouse_event_t *e) {
+    struct client_t *m;
+    int sz;
+
+    if (!CAN_TILE_(e->client)) {
+        resize_free(self, e);
+        return;
+    }
+    NEXT_CLIENT_(m, self->first, CAN_TILE_(m));
+    if (m != e->client || nil_.w == 0) {
+        return;
+    }
+    sz = ((e->x2 - nil_.x) * 100 + nil_.w / 2) / nil_.w;
+    if (sz < MIN_MASTER_SIZE_) {
+        sz = MIN_MASTER_SIZE_;
+    } else if (sz > MAX_MASTER_SIZE_) {
+        sz = MAX_MASTER_SIZE_;
+    }
+    if (sz != self->master_size) {
+        self->master_size = sz;
+        mark_ws(self);
+    }
+}
+
+/** Only the focused client is mapped, it fills the whole area
+ * Other tiled clients are sized too so that cycling needs no configure.
+ */
+static
+void arrange_mono(struct workspace_t *self) {
+    struct client_t *c;
+
+    if (!self->focus) {
+        NEXT_CLIENT_(c, self->first, CAN_FOCUS_(c));
+        if (!c) {
+            return;
+        }
+        set_focus(self, c);
+    }
+    for (c = self->first; c; c = c->next) {
+        if (!CAN_FOCUS_(c)) {
+            continue;
+        }
+        if (CAN_TILE_(c)) {
+            RESIZE_CLIENT_(c, nil_.x, nil_.y, nil_.w, nil_.h);
+            update_client_geom(c);
+        }
+        if (c == self->focus) {
+            if (NIL_HAS_FLAG(c->flags, CLIENT_HIDDEN)) {
+                NIL_CLEAR_FLAG(c->flags, CLIENT_HIDDEN);
+                show_client(c);
+            }
+        } else if (!NIL_HAS_FLAG(c->flags, CLIENT_HIDDEN)) {
+            NIL_SET_FLAG(c->flags, CLIENT_HIDDEN);
+            hide_client(c);
+        }
+    }
+}
+
+/** Replace the visible client with another one
+ * Costs one map and one unmap, nothing is rearranged.
+ */
+static
+void select_mono(struct workspace_t *self, struct client_t *c) {
+    struct client_t *prev;
+
+    if (c == self->focus) {
+        return;
+    }
+    prev = self->focus;
+    if (NIL_HAS_FLAG(c->flags, CLIENT_HIDDEN)) {
+        NIL_CLEAR_FLAG(c->flags, CLIENT_HIDDEN);
+        show_client(c);
+    }
+    set_focus(self, c);
+    (*nil_.be->set_input_focus)(c->win);
+    if (prev) {
+        NIL_SET_FLAG(prev->flags, CLIENT_HIDDEN);
+        hide_client(prev);
+    }
+}
+
+static
+void focus_mono(struct workspace_t *self, const int dir) {
+    struct client_t *c;
+
+    c = next_focus(self, dir);
+    if (c) {
+        select_mono(self, c);
+    }
+}
+
 /** Handlers for each type of layouts
  */
 static const struct layout_t layouts_[] = {
@@ -202,6 +355,7 @@ static const struct layout_t layouts_[] = {
         .symbol     = SYMBOL_TILE_,
         .arrange    = &arrange_tile,
         .focus      = &focus_tile,
+        .select     = &select_tile,
         .swap       = &swap_tile,
         .move       = &move_tile,
         .resize     = &resize_tile,
@@ -210,6 +364,16 @@ static const struct layout_t layouts_[] = {
         .symbol     = SYMBOL_FREE_,
         .arrange    = 0,
         .focus      = &focus_tile,
+        .select     = &select_tile,
+        .swap       = 0,
+        .move       = &move_free,
+        .resize     = &resize_free,
+    },
+    [LAYOUT_MONO] = {
+        .symbol     = SYMBOL_MONO_,
+        .arrange    = &arrange_mono,
+        .focus      = &focus_mono,
+        .select     = &select_mono,
         .swap       = 0,
         .move       = &move_free,
         .resize     = &resize_free,
@@ -222,28 +386,188 @@ const struct layout_t *get_layout(struct workspace_t *self) {
     return &layouts_[self->layout];
 }
 
+/** Mark a client as focused, the input focus is not changed
+ */
+void set_focus(struct workspace_t *self, struct client_t *c) {
+    if (c != self->focus) {
+        if (self->focus) {
+            blur_client(self->focus);
+        }
+        focus_client(c);
+        self->focus = c;
+    }
+    /* the kept focus of a workspace shown again is the most recent too,
+     * the history is reordered once cycling ends */
+    if (!NIL_HAS_FLAG(self->flags, WS_CYCLE) && (nil_.mru != c)) {
+        touch_client(c);
+    }
+}
+
+/** The focused client is gone, focus the previous one of the history
+ * It is the most recent one that can take the focus, else the root has it.
+ */
+void restore_focus(struct workspace_t *self) {
+    struct client_t *c;
+
+    self->focus = 0;
+    for (c = self->mru; c && !CAN_FOCUS_(c); c = c->mru_next) {
+    }
+    if (!c) {
+        if (self == &nil_.ws[nil_.ws_idx]) {
+            (*nil_.be->set_input_focus)(nil_.scr->root);
+        }
+        return;
+    }
+    set_focus(self, c);
+    /* a client hidden by monocle gets it when shown */
+    if (self == &nil_.ws[nil_.ws_idx]
+        && !NIL_HAS_FLAG(c->flags, CLIENT_HIDDEN)) {
+        (*nil_.be->set_input_focus)(c->win);
+    }
+}
+
+/** Give the focus to a client of the workspace the way its layout does
+ */
+void select_client(struct workspace_t *self, struct client_t *c) {
+    (*layouts_[self->layout].select)(self, c);
+}
+
+/** Step back in the focus history, alt-tab style
+ * The history is kept as is while cycling so that each step goes one client
+ * further. The keyboard is grabbed to see the modifier released, which ends
+ * the cycle, see end_cycle.
+ */
+void cycle_ws(struct workspace_t *self) {
+    struct client_t *c, *start;
+
+    start = self->cycle ? self->cycle : self->mru;
+    if (!start) {
+        return;
+    }
+    c = start;
+    do {
+        c = c->mru_next ? c->mru_next : self->mru;
+    } while (c != start && !CAN_FOCUS_(c));
+    if (c == start) {
+        return;
+    }
+    if (!NIL_HAS_FLAG(self->flags, WS_CYCLE)) {
+        NIL_SET_FLAG(self->flags, WS_CYCLE);
+        (*nil_.be->grab_keyboard)();
+    }
+    self->cycle = c;
+    select_client(self, c);
+}
+
+/** Stop cycling, the client reached becomes the most recent
+ */
+void end_cycle(struct workspace_t *self) {
+    if (!NIL_HAS_FLAG(self->flags, WS_CYCLE)) {
+        return;
+    }
+    NIL_CLEAR_FLAG(self->flags, WS_CYCLE);
+    (*nil_.be->ungrab_keyboard)();
+    if (self->cycle) {
+        touch_client(self->cycle);
+        self->cycle = 0;
+    }
+}
+
 void arrange_ws(struct workspace_t *self) {
     const struct layout_t *h;
+    struct client_t *c;
 
     NIL_LOG("arrange %d", self - nil_.ws);
     h = &layouts_[self->layout];
+    if (self->layout != LAYOUT_MONO) {
+        /* show clients hidden by monocle mode */
+        for (c = self->first; c; c = c->next) {
+            if (NIL_HAS_FLAG(c->flags, CLIENT_HIDDEN)) {
+                NIL_CLEAR_FLAG(c->flags, CLIENT_HIDDEN);
+                show_client(c);
+            }
+        }
+    }
     if (h->arrange) {
         (*h->arrange)(self);
     }
 }
 
-/** Hide all clients in the workspace
+/** Arrange the workspace later, see settle_ws
+ */
+void mark_ws(struct workspace_t *self) {
+    NIL_SET_FLAG(self->flags, WS_DIRTY);
+}
+
+/** Arrange the current workspace if it was marked, then map new clients
+ * Called once at the end of each events batch, hidden workspaces are
+ * arranged when shown. The newest client gets the focus.
+ */
+void settle_ws() {
+    struct workspace_t *ws;
+    struct client_t *c, *focus;
+
+    ws = &nil_.ws[nil_.ws_idx];
+    focus = 0;
+    if (NIL_HAS_FLAG(ws->flags, WS_PENDING)) {
+        NEXT_CLIENT_(focus, ws->first,
+            NIL_HAS_FLAG(focus->flags, CLIENT_PENDING));
+        if (focus) {
+            /* layouts may depend on the focus */
+            set_focus(ws, focus);
+            mark_ws(ws);
+        }
+    }
+    if (NIL_HAS_FLAG(ws->flags, WS_DIRTY)) {
+        NIL_CLEAR_FLAG(ws->flags, WS_DIRTY);
+        arrange_ws(ws);
+    }
+    if (!NIL_HAS_FLAG(ws->flags, WS_PENDING)) {
+        return;
+    }
+    NIL_CLEAR_FLAG(ws->flags, WS_PENDING);
+    for (c = focus; c; c = c->next) {
+        if (NIL_HAS_FLAG(c->flags, CLIENT_PENDING)) {
+            NIL_CLEAR_FLAG(c->flags, CLIENT_PENDING);
+            if (!NIL_HAS_FLAG(c->flags, CLIENT_HIDDEN)) {
+                show_client(c);
+            }
+        }
+    }
+    if (focus) {
+        (*nil_.be->set_input_focus)(focus->win);
+    }
+}
+
+/** Hide the workspace container, its clients stay mapped inside
  */
 void hide_ws(struct workspace_t *self)
 {
-    struct client_t *c;
-    EACH_CLIENT_(self, c, hide_client);
+    (*nil_.be->unmap_window)(self->win);
 }
 
+/** Arrange if needed, map clients still pending then show the container
+ */
 void show_ws(struct workspace_t *self)
 {
     struct client_t *c;
-    EACH_CLIENT_(self, c, show_client);
+
+    if (NIL_HAS_FLAG(self->flags, WS_DIRTY)) {
+        NIL_CLEAR_FLAG(self->flags, WS_DIRTY);
+        arrange_ws(self);
+    }
+    if (NIL_HAS_FLAG(self->flags, WS_PENDING)) {
+        NIL_CLEAR_FLAG(self->flags, WS_PENDING);
+        for (c = self->first; c; c = c->next) {
+            if (NIL_HAS_FLAG(c->flags, CLIENT_PENDING)) {
+                NIL_CLEAR_FLAG(c->flags, CLIENT_PENDING);
+                if (!NIL_HAS_FLAG(c->flags, CLIENT_HIDDEN)) {
+                    show_client(c);
+                }
+            }
+        }
+    }
+    (*nil_.be->map_window)(self->win);
 }
 
 /* vim: set ts=4 sw=4 expandtab: */
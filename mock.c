@@ -0,0 +1,450 @@
+/*
+ * Nilwm - Lightweight X window manager.
+ * See LICENSE file for copyright and license details.
+ */
+
+#include <stdlib.h>
+#include <string.h>
+#include "nilwm.h"
+
+#define KEYSYM_COLS_        4
+
+/* a window known by the scripted server */
+struct mock_window_t {
+    xcb_window_t win;
+    struct window_info_t info;
+};
+
+static struct mock_request_t *reqs_;
+static unsigned int reqs_len_;
+static unsigned int reqs_size_;
+static unsigned int seq_;           /* sequence number of the last request */
+
+/* text property fetch not polled yet */
+struct mock_fetch_t {
+    unsigned int seq;
+    xcb_window_t win;
+};
+
+static struct mock_window_t *wins_;
+static unsigned int wins_len_;
+static unsigned int wins_size_;
+
+static struct mock_fetch_t *fetches_;
+static unsigned int fetches_len_;
+static unsigned int fetches_size_;
+
+static xcb_keysym_t keysyms_[256][KEYSYM_COLS_];
+
+static xcb_generic_event_t *events_;
+static unsigned int events_head_;
+static unsigned int events_len_;
+static unsigned int events_size_;
+
+/** Double the capacity of an array
+ * @return -1 if out of memory, the array is kept
+ */
+static
+int grow(void **arr, unsigned int *size, size_t elem) {
+    void *p;
+    unsigned int n;
+
+    n = *size ? *size * 2 : 64;
+    p = realloc(*arr, n * elem);
+    if (!p) {
+        NIL_ERR("out of mem %u", n);
+        return -1;
+    }
+    *arr = p;
+    *size = n;
+    return 0;
+}
+
+/** Log a request, it is still numbered if the log is full
+ */
+static
+void record(uint8_t type, xcb_window_t win, uint32_t mask) {
+    ++seq_;
+    if (reqs_len_ >= reqs_size_
+        && grow((void **)&reqs_, &reqs_size_, sizeof(reqs_[0])) != 0) {
+        return;
+    }
+    reqs_[reqs_len_].type = type;
+    reqs_[reqs_len_].win = win;
+    reqs_[reqs_len_].mask = mask;
+    ++reqs_len_;
+}
+
+static
+struct mock_window_t *find_window(xcb_window_t win) {
+    unsigned int i;
+
+    for (i = 0; i < wins_len_; ++i) {
+        if (wins_[i].win == win) {
+            return &wins_[i];
+        }
+    }
+    return 0;
+}
+
+/** The mock has no connection to watch
+ */
+static
+int get_fd() {
+    return -1;
+}
+
+static
+int has_error() {
+    return 0;
+}
+
+static
+int flush() {
+    return 1;
+}
+
+static
+unsigned int no_operation() {
+    record(XCB_NO_OPERATION, XCB_NONE, 0);
+    return seq_;
+}
+
+/** Pop the next scripted event, the caller frees it
+ */
+static
+xcb_generic_event_t *poll_event() {
+    xcb_generic_event_t *e;
+
+    if (events_head_ >= events_len_) {
+        events_head_ = events_len_ = 0;
+        return 0;
+    }
+    e = malloc(sizeof(xcb_generic_event_t));
+    if (e) {
+        memcpy(e, &events_[events_head_++], sizeof(xcb_generic_event_t));
+    }
+    return e;
+}
+
+static
+void query_window(xcb_window_t win, struct client_query_t *q) {
+    memset(q, 0, sizeof(struct client_query_t));
+    q->win = win;
+    record(XCB_GET_WINDOW_ATTRIBUTES, win, 0);
+    record(XCB_GET_GEOMETRY, win, 0);
+    record(XCB_GET_PROPERTY, win, 0);   /* WM_NORMAL_HINTS */
+    record(XCB_GET_PROPERTY, win, 0);   /* WM_PROTOCOLS */
+    record(XCB_GET_PROPERTY, win, 0);   /* WM_NAME */
+    record(XCB_GET_PROPERTY, win, 0);   /* _NET_WM_NAME */
+}
+
+static
+void discard_window(struct client_query_t *NIL_UNUSED(q)) {
+}
+
+/** Answer from the scripted windows
+ */
+static
+int read_window(struct client_query_t *q, struct window_info_t *info) {
+    struct mock_window_t *w;
+
+    w = find_window(q->win);
+    if (!w) {
+        memset(info, 0, sizeof(struct window_info_t));
+        return -1;
+    }
+    *info = w->info;
+    info->title = w->info.title ? strdup(w->info.title) : 0;
+    return 0;
+}
+
+static
+void configure_window(xcb_window_t win, uint16_t mask, const uint32_t *vals) {
+    struct mock_window_t *w;
+
+    record(XCB_CONFIGURE_WINDOW, win, mask);
+    w = find_window(win);
+    if (!w) {
+        return;
+    }
+    w->info.has_geom = 1;
+    if (NIL_HAS_FLAG(mask, XCB_CONFIG_WINDOW_X)) {
+        w->info.geom.x = *vals++;
+    }
+    if (NIL_HAS_FLAG(mask, XCB_CONFIG_WINDOW_Y)) {
+        w->info.geom.y = *vals++;
+    }
+    if (NIL_HAS_FLAG(mask, XCB_CONFIG_WINDOW_WIDTH)) {
+        w->info.geom.w = *vals++;
+    }
+    if (NIL_HAS_FLAG(mask, XCB_CONFIG_WINDOW_HEIGHT)) {
+        w->info.geom.h = *vals++;
+    }
+}
+
+static
+void change_window_attributes(xcb_window_t win, uint32_t mask,
+    const uint32_t *NIL_UNUSED(vals)) {
+    record(XCB_CHANGE_WINDOW_ATTRIBUTES, win, mask);
+}
+
+static
+void map_window(xcb_window_t win) {
+    struct mock_window_t *w;
+
+    record(XCB_MAP_WINDOW, win, 0);
+    w = find_window(win);
+    if (w) {
+        w->info.map_state = XCB_MAP_STATE_VIEWABLE;
+    }
+}
+
+static
+void unmap_window(xcb_window_t win) {
+    struct mock_window_t *w;
+
+    record(XCB_UNMAP_WINDOW, win, 0);
+    w = find_window(win);
+    if (w) {
+        w->info.map_state = XCB_MAP_STATE_UNMAPPED;
+    }
+}
+
+static
+void reparent_window(xcb_window_t win, xcb_window_t NIL_UNUSED(parent),
+    int16_t NIL_UNUSED(x), int16_t NIL_UNUSED(y)) {
+    record(XCB_REPARENT_WINDOW, win, 0);
+}
+
+static
+void change_save_set(uint8_t NIL_UNUSED(mode), xcb_window_t win) {
+    record(XCB_CHANGE_SAVE_SET, win, 0);
+}
+
+static
+void set_input_focus(xcb_window_t win) {
+    record(XCB_SET_INPUT_FOCUS, win, 0);
+}
+
+static
+void send_event(xcb_window_t win, const char *NIL_UNUSED(e)) {
+    record(XCB_SEND_EVENT, win, 0);
+}
+
+static
+void kill_client(xcb_window_t win) {
+    record(XCB_KILL_CLIENT, win, 0);
+}
+
+static
+void grab_pointer(xcb_cursor_t NIL_UNUSED(cursor)) {
+    record(XCB_GRAB_POINTER, XCB_NONE, 0);
+}
+
+static
+void ungrab_pointer() {
+    record(XCB_UNGRAB_POINTER, XCB_NONE, 0);
+}
+
+static
+void warp_pointer(xcb_window_t win, int16_t NIL_UNUSED(x),
+    int16_t NIL_UNUSED(y)) {
+    record(XCB_WARP_POINTER, win, 0);
+}
+
+static
+void allow_events(uint8_t NIL_UNUSED(mode), xcb_timestamp_t NIL_UNUSED(time)) {
+    record(XCB_ALLOW_EVENTS, XCB_NONE, 0);
+}
+
+static
+void fill_rectangle(xcb_drawable_t d, xcb_gcontext_t NIL_UNUSED(gc),
+    const xcb_rectangle_t *NIL_UNUSED(rect)) {
+    record(XCB_POLY_FILL_RECTANGLE, d, 0);
+}
+
+static
+void draw_text(xcb_drawable_t d, xcb_gcontext_t NIL_UNUSED(gc),
+    int16_t NIL_UNUSED(x), int16_t NIL_UNUSED(y),
+    const char *NIL_UNUSED(str), uint8_t NIL_UNUSED(len)) {
+    record(XCB_IMAGE_TEXT_8, d, 0);
+}
+
+static
+void copy_area(xcb_drawable_t NIL_UNUSED(src), xcb_drawable_t dst,
+    xcb_gcontext_t NIL_UNUSED(gc), const xcb_rectangle_t *NIL_UNUSED(rect)) {
+    record(XCB_COPY_AREA, dst, 0);
+}
+
+static
+unsigned int query_text_property(xcb_window_t win,
+    xcb_atom_t NIL_UNUSED(atom)) {
+    record(XCB_GET_PROPERTY, win, 0);
+    /* other windows have no property */
+    if (find_window(win) && (fetches_len_ < fetches_size_
+        || grow((void **)&fetches_, &fetches_size_, sizeof(fetches_[0])) == 0)) {
+        fetches_[fetches_len_].seq = seq_;
+        fetches_[fetches_len_].win = win;
+        ++fetches_len_;
+    }
+    return seq_;
+}
+
+/** Answer with the title of a scripted window, whatever the atom
+ * The reply is there at the first poll, as if xcb had already read it, and
+ * the connection never wakes the loop for it.
+ */
+static
+int poll_text_property(unsigned int seq, struct text_t *t) {
+    struct mock_window_t *w;
+    unsigned int i, len;
+
+    for (i = 0; (i < fetches_len_) && (fetches_[i].seq != seq); ++i) {
+    }
+    if (i == fetches_len_) {
+        return -1;
+    }
+    w = find_window(fetches_[i].win);
+    fetches_[i] = fetches_[--fetches_len_];
+    if (!w || !w->info.title) {
+        return -1;
+    }
+    len = strlen(w->info.title);
+    if (reserve_text(t, len) != 0) {
+        return -1;
+    }
+    memcpy(t->s, w->info.title, len + 1);
+    t->len = len;
+    return 1;
+}
+
+static
+void grab_keyboard() {
+    record(XCB_GRAB_KEYBOARD, XCB_NONE, 0);
+}
+
+static
+void ungrab_keyboard() {
+    record(XCB_UNGRAB_KEYBOARD, XCB_NONE, 0);
+}
+
+static
+xcb_keysym_t lookup_keysym(xcb_keycode_t code, int col) {
+    if (col < 0 || col >= KEYSYM_COLS_) {
+        return XCB_NO_SYMBOL;
+    }
+    return keysyms_[code][col];
+}
+
+/** Add a window to the scripted server, replacing any with the same id
+ * The model follows the geometry and map state requested afterwards.
+ */
+void mock_add_window(xcb_window_t win, const struct window_info_t *info) {
+    struct mock_window_t *w;
+
+    w = find_window(win);
+    if (w) {
+        free(w->info.title);
+    } else {
+        if (wins_len_ >= wins_size_
+            && grow((void **)&wins_, &wins_size_, sizeof(wins_[0])) != 0) {
+            return;
+        }
+        w = &wins_[wins_len_++];
+        w->win = win;
+    }
+    w->info = *info;
+    w->info.title = info->title ? strdup(info->title) : 0;
+}
+
+/** Queue an event returned by poll_event
+ */
+void mock_push_event(const void *e) {
+    if (events_len_ >= events_size_
+        && grow((void **)&events_, &events_size_, sizeof(events_[0])) != 0) {
+        return;
+    }
+    memset(&events_[events_len_], 0, sizeof(events_[0]));
+    memcpy(&events_[events_len_++], e, NIL_EVENT_SIZE);
+}
+
+void mock_set_keysym(xcb_keycode_t code, int col, xcb_keysym_t sym) {
+    if (col >= 0 && col < KEYSYM_COLS_) {
+        keysyms_[code][col] = sym;
+    }
+}
+
+/** Forget requests, windows, events and keyboard mapping
+ */
+void mock_reset() {
+    unsigned int i;
+
+    for (i = 0; i < wins_len_; ++i) {
+        free(wins_[i].info.title);
+    }
+    free(wins_);
+    free(reqs_);
+    free(events_);
+    free(fetches_);
+    fetches_ = 0;
+    fetches_len_ = fetches_size_ = 0;
+    wins_ = 0;
+    reqs_ = 0;
+    events_ = 0;
+    wins_len_ = wins_size_ = 0;
+    reqs_len_ = reqs_size_ = 0;
+    events_head_ = events_len_ = events_size_ = 0;
+    seq_ = 0;
+    memset(keysyms_, 0, sizeof(keysyms_));
+}
+
+void mock_clear_requests() {
+    reqs_len_ = 0;
+}
+
+unsigned int mock_num_requests() {
+    return reqs_len_;
+}
+
+const struct mock_request_t *mock_requests() {
+    return reqs_;
+}
+
+/** Requests are logged, replies come from the scripted windows
+ */
+const struct backend_t backend_mock_ = {
+    .name                       = "mock",
+    .get_fd                     = &get_fd,
+    .has_error                  = &has_error,
+    .flush                      = &flush,
+    .no_operation               = &no_operation,
+    .poll_event                 = &poll_event,
+    .poll_queued_event          = &poll_event,
+    .query_window               = &query_window,
+    .discard_window             = &discard_window,
+    .read_window                = &read_window,
+    .configure_window           = &configure_window,
+    .change_window_attributes   = &change_window_attributes,
+    .map_window                 = &map_window,
+    .unmap_window               = &unmap_window,
+    .reparent_window            = &reparent_window,
+    .change_save_set            = &change_save_set,
+    .set_input_focus            = &set_input_focus,
+    .send_event                 = &send_event,
+    .kill_client                = &kill_client,
+    .grab_pointer               = &grab_pointer,
+    .ungrab_pointer             = &ungrab_pointer,
+    .warp_pointer               = &warp_pointer,
+    .allow_events               = &allow_events,
+    .fill_rectangle             = &fill_rectangle,
+    .draw_text                  = &draw_text,
+    .copy_area                  = &copy_area,
+    .query_text_property        = &query_text_property,
+    .poll_text_property         = &poll_text_property,
+    .grab_keyboard              = &grab_keyboard,
+    .ungrab_keyboard            = &ungrab_keyboard,
+    .lookup_keysym              = &lookup_keysym,
+};
+
+/* vim: set ts=4 sw=4 expandtab: */
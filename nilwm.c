@@ -7,7 +7,6 @@
 #include <string.h>
 #include <unistd.h>
 #include <signal.h>
-#include <sys/wait.h>
 #include <X11/keysym.h>
 #include <X11/cursorfont.h>
 #include "nilwm.h"
@@ -32,42 +31,66 @@
     func(win, key, mod | nil_.mask_numlock);                            \
     func(win, key, mod | XCB_MOD_MASK_LOCK | nil_.mask_numlock)
 
-struct nilwm_t nil_;
-
-static
-void handle_signal(int sig) {
-    switch (sig) {
-    case SIGCHLD:
-        while (0 < waitpid(-1, 0, WNOHANG)) {
-        }
-        break;
-    }
-}
-
-static
-int is_proto_delete(const struct client_t *c) {
-    xcb_get_property_cookie_t cookie;
-    xcb_icccm_get_wm_protocols_reply_t proto;
-    unsigned int i;
-
-    cookie = xcb_icccm_get_wm_protocols_unchecked(nil_.con, c->win, nil_.atom.wm_delete);
-    if (xcb_icccm_get_wm_protocols_reply(nil_.con, cookie, &proto, 0)) {
-        for (i = 0; i < proto.atoms_len; i++) {
-            if (proto.atoms[i] == nil_.atom.wm_delete) {
-                xcb_icccm_get_wm_protocols_reply_wipe(&proto);
-                return 1;
-            }
-        }
-        xcb_icccm_get_wm_protocols_reply_wipe(&proto);
-    }
-    return 0;
-}
+/* replies pending during startup */
+struct color_query_t {
+    int named;
+    xcb_alloc_color_cookie_t cookie;
+    xcb_alloc_named_color_cookie_t named_cookie;
+};
+
+static const struct {
+    const char *name;
+    xcb_atom_t *atom;
+} ATOMS_[] = {
+    { "_NET_SUPPORTED",     &nil_.atom.net_supported },
+    { "_NET_WM_NAME",       &nil_.atom.net_wm_name },
+    { "WM_PROTOCOLS",       &nil_.atom.wm_protocols },
+    { "WM_DELETE_WINDOW",   &nil_.atom.wm_delete },
+    { "WM_STATE",           &nil_.atom.wm_state },
+    { "UTF8_STRING",        &nil_.atom.utf8_string },
+};
+
+static const struct {
+    const char *const *name;
+    uint32_t *pixel;
+} COLORS_[] = {
+    { &cfg_.border_color,   &nil_.color.border },
+    { &cfg_.focus_color,    &nil_.color.focus },
+    { &cfg_.bar_bg_color,   &nil_.color.bar_bg },
+    { &cfg_.bar_fg_color,   &nil_.color.bar_fg },
+    { &cfg_.bar_sel_color,  &nil_.color.bar_sel },
+    { &cfg_.bar_occ_color,  &nil_.color.bar_occ },
+    { &cfg_.bar_urg_color,  &nil_.color.bar_urg },
+};
+
+static struct {
+    xcb_void_cookie_t redirect;
+    xcb_query_tree_cookie_t tree;
+    xcb_get_modifier_mapping_cookie_t modmap;
+    xcb_intern_atom_cookie_t atom[NIL_LEN(ATOMS_)];
+    struct color_query_t color[NIL_LEN(COLORS_)];
+    xcb_void_cookie_t cursor[NUM_CURSOR];
+    xcb_void_cookie_t font;
+    xcb_query_font_cookie_t font_info;
+} boot_;
+
+struct nilwm_t nil_ = {
+    .be = &backend_xcb_,
+};
 
 void spawn(const struct arg_t *arg) {
     pid_t pid;
+    sigset_t mask;
+
+    if (!nil_.con) {    /* replaying, no server to run it on */
+        return;
+    }
     pid = fork();
     if (pid == 0) {   /* child process */
         close(xcb_get_file_descriptor(nil_.con));
+        /* signals blocked for signalfd would stay blocked after exec */
+        sigemptyset(&mask);
+        sigprocmask(SIG_SETMASK, &mask, 0);
         setsid();
         execvp(((char **)arg->v)[0], (char **)arg->v);
         NIL_ERR("execvp %s", ((char **)arg->v)[0]);
@@ -89,6 +112,30 @@ void focus(const struct arg_t *arg) {
     }
 }
 
+/** Go back to the previously focused client, on any workspace
+ */
+void focus_last(const struct arg_t *NIL_UNUSED(arg)) {
+    struct client_t *c;
+    struct arg_t ws;
+
+    c = nil_.mru;
+    if (c && c == nil_.ws[nil_.ws_idx].focus) {
+        c = c->gmru_next;
+    }
+    if (!c) {
+        return;
+    }
+    ws.u = c->ws - nil_.ws;
+    change_ws(&ws);
+    select_client(c->ws, c);
+}
+
+/** Cycle the focus history of the current workspace
+ */
+void cycle(const struct arg_t *NIL_UNUSED(arg)) {
+    cycle_ws(&nil_.ws[nil_.ws_idx]);
+}
+
 /** Swap focused client with next/prev/master one
  */
 void swap(const struct arg_t *arg) {
@@ -109,7 +156,7 @@ void kill_focused(const struct arg_t *NIL_UNUSED(arg)) {
     if (!c) {
         return;
     }
-    if (is_proto_delete(c)) {
+    if (NIL_HAS_FLAG(c->flags, CLIENT_DELETE)) {
         xcb_client_message_event_t e;
         memset(&e, 0, sizeof(e));
         e.response_type     = XCB_CLIENT_MESSAGE;
@@ -119,11 +166,10 @@ void kill_focused(const struct arg_t *NIL_UNUSED(arg)) {
         e.data.data32[0]    = nil_.atom.wm_delete;
         e.data.data32[1]    = XCB_CURRENT_TIME;
         NIL_LOG("send kill %d", c->win);
-        xcb_send_event(nil_.con, 0, c->win, XCB_EVENT_MASK_NO_EVENT,
-            (const char *)&e);
+        (*nil_.be->send_event)(c->win, (const char *)&e);
     } else {
         NIL_LOG("force kill %d", c->win);
-        xcb_kill_client(nil_.con, c->win);
+        (*nil_.be->kill_client)(c->win);
     }
 }
 
@@ -140,7 +186,7 @@ void toggle_floating(const struct arg_t *NIL_UNUSED(arg)) {
     } else {
         NIL_SET_FLAG(c->flags, CLIENT_FLOAT);
     }
-    arrange_ws(&nil_.ws[nil_.ws_idx]);
+    mark_ws(&nil_.ws[nil_.ws_idx]);
     raise_client(c);
 }
 
@@ -154,7 +200,7 @@ void set_msize(const struct arg_t *arg) {
     sz = ws->master_size + arg->i;
     if (sz > 0 && sz < 100) {
         ws->master_size = sz;
-        arrange_ws(ws);
+        mark_ws(ws);
     }
 }
 
@@ -163,26 +209,33 @@ void set_layout(const struct arg_t *arg) {
 
     ws = &nil_.ws[nil_.ws_idx];
     if (arg->i < 0) {   /* find next layout */
-        ws->layout = (ws->layout + 1)  & (NUM_LAYOUT - 1);
+        ws->layout = (ws->layout + 1) % NUM_LAYOUT;
     } else {
-        ws->layout = arg->i & (NUM_LAYOUT - 1);
+        ws->layout = arg->i % NUM_LAYOUT;
     }
     /* update symbol and rearrange */
     update_bar_sym();
-    arrange_ws(ws);
+    mark_ws(ws);
 }
 
 /** Switch to other workspace
  */
 void change_ws(const struct arg_t *arg) {
+    struct workspace_t *ws;
     unsigned int prev_idx;
+
     if (arg->u == nil_.ws_idx || arg->u >= cfg_.num_workspaces) {
         return;
     }
+    end_cycle(&nil_.ws[nil_.ws_idx]);
     hide_ws(&nil_.ws[nil_.ws_idx]);
     prev_idx = nil_.ws_idx;
     nil_.ws_idx = arg->u;
-    show_ws(&nil_.ws[nil_.ws_idx]);
+    ws = &nil_.ws[nil_.ws_idx];
+    show_ws(ws);
+    if (ws->focus) {
+        set_focus(ws, ws->focus);       /* focused again, see focus_last */
+    }
     update_bar_ws(prev_idx);
     update_bar_ws(nil_.ws_idx);
 }
@@ -200,18 +253,20 @@ void push(const struct arg_t *arg) {
         return;
     }
     dst = &nil_.ws[arg->u];
-    /* move client and hide it */
+    /* move client, it is hidden with the container of dst */
     detach_client(src->focus);
     attach_client(src->focus, dst);
-    hide_client(src->focus);
-    src->focus = 0;
-    /* rearrange and update new workspace indicator */
-    arrange_ws(src);
+    reparent_client(src->focus, dst);
+    restore_focus(src);
+    /* both are arranged when shown, update new workspace indicator */
+    mark_ws(src);
+    mark_ws(dst);
     update_bar_ws(arg->u);
 }
 
 void quit(const struct arg_t *NIL_UNUSED(arg)) {
     NIL_LOG("%s", "quit");
+    stop_events();
 }
 
 int check_key(unsigned int mod, xcb_keysym_t key) {
@@ -235,11 +290,11 @@ xcb_keysym_t get_keysym(xcb_keycode_t keycode, uint16_t state) {
 
     /* Mode_Switch is ON */
     if (state & nil_.mask_modeswitch) {
-        k0 = xcb_key_symbols_get_keysym(nil_.key_syms, keycode, 2);
-        k1 = xcb_key_symbols_get_keysym(nil_.key_syms, keycode, 3);
+        k0 = (*nil_.be->lookup_keysym)(keycode, 2);
+        k1 = (*nil_.be->lookup_keysym)(keycode, 3);
     } else {
-        k0 = xcb_key_symbols_get_keysym(nil_.key_syms, keycode, 0);
-        k1 = xcb_key_symbols_get_keysym(nil_.key_syms, keycode, 1);
+        k0 = (*nil_.be->lookup_keysym)(keycode, 0);
+        k1 = (*nil_.be->lookup_keysym)(keycode, 1);
     }
     if (k1 == XCB_NO_SYMBOL) {
         k1 = k0;
@@ -282,66 +337,65 @@ xcb_keycode_t get_keycode(xcb_keysym_t keysym) {
     return k;
 }
 
-/** Get window text property
+/** Make room for a text of len characters and its terminator
+ * The buffer only grows, a text of the same size is read again in place.
+ * @return -1 if out of memory, the text is kept
  */
-int get_text_prop(xcb_window_t win, xcb_atom_t atom, char *s, unsigned int len) {
-    xcb_get_property_cookie_t cookie;
-    xcb_icccm_get_text_property_reply_t reply;
+int reserve_text(struct text_t *t, unsigned int len) {
+    char *s;
+    unsigned int n;
 
-    if (len == 0) {
+    if (len < t->size) {
         return 0;
     }
-    cookie = xcb_icccm_get_text_property(nil_.con, win, atom);
-    if (!xcb_icccm_get_text_property_reply(nil_.con, cookie, &reply, 0)) {
-        NIL_LOG("no reply get_text_property %d", atom);
-        return -1;
+    n = t->size ? t->size : 64;
+    while (n <= len) {
+        n *= 2;
     }
-    if (reply.encoding != XCB_ATOM_STRING) {
-        xcb_icccm_get_text_property_reply_wipe(&reply);
+    s = realloc(t->s, n);
+    if (!s) {
+        NIL_ERR("out of mem %u", n);
         return -1;
     }
-    --len;  /* null terminated */
-    if (reply.name_len < len) {
-        len = reply.name_len;
-    }
-    strncpy(s, reply.name, len);
-    s[len] = '\0';
-    xcb_icccm_get_text_property_reply_wipe(&reply);
-    return (int)len;
+    t->s = s;
+    t->size = n;
+    return 0;
 }
 
-/** Predict text width
+/** Predict text width from the metrics read once by init_font
  */
 int cal_text_width(const char *text, int len) {
-    xcb_query_text_extents_cookie_t cookie;
-    xcb_query_text_extents_reply_t *reply;
+    int i, w;
 
-    cookie = xcb_query_text_extents(nil_.con, nil_.font.id, len, (xcb_char2b_t*)text);
-    reply = xcb_query_text_extents_reply(nil_.con, cookie, 0);
-    if (!reply) {
-        NIL_ERR("get text extents %s", text);
-        return 7;   /* minimum */
+    w = 0;
+    for (i = 0; i < len; ++i) {
+        w += nil_.font.width[(uint8_t)text[i]];
     }
-    len = reply->overall_width;
-    free(reply);
-    return len;
+    return w;
 }
 
 static
-int get_color(const char *str, uint32_t *color)
-{
-    if (str[0] == '#') {        /* in hex format */
-        uint16_t r, g, b;
-        xcb_alloc_color_cookie_t cookie;
-        xcb_alloc_color_reply_t *reply;
+void query_color(const char *str, struct color_query_t *q) {
+    uint16_t r, g, b;
 
-        if (sscanf(str + 1, "%2hx%2hx%2hx", &r, &g, &b) != 3) {
-            NIL_ERR("color format %s", str);
-            return -1;
-        }
-        cookie = xcb_alloc_color(nil_.con, nil_.scr->default_colormap,
+    q->named = (str[0] != '#');
+    if (q->named) {
+        q->named_cookie = xcb_alloc_named_color(nil_.con, nil_.scr->default_colormap,
+            strlen(str), str);
+    } else if (sscanf(str + 1, "%2hx%2hx%2hx", &r, &g, &b) == 3) {  /* in hex format */
+        q->cookie = xcb_alloc_color(nil_.con, nil_.scr->default_colormap,
             r << 8, g << 8, b << 8);
-        reply = xcb_alloc_color_reply(nil_.con, cookie, 0);
+    } else {
+        q->cookie.sequence = 0;
+    }
+}
+
+static
+int get_color(const char *str, const struct color_query_t *q, uint32_t *color) {
+    if (q->named) {
+        xcb_alloc_named_color_reply_t *reply;
+
+        reply = xcb_alloc_named_color_reply(nil_.con, q->named_cookie, 0);
         if (!reply) {
             NIL_ERR("no color %s", str);
             return -1;
@@ -349,12 +403,13 @@ int get_color(const char *str, uint32_t *color)
         *color = reply->pixel;
         free(reply);
     } else {
-        xcb_alloc_named_color_cookie_t cookie;
-        xcb_alloc_named_color_reply_t *reply;
+        xcb_alloc_color_reply_t *reply;
 
-        cookie = xcb_alloc_named_color(nil_.con, nil_.scr->default_colormap,
-            strlen(str), str);
-        reply = xcb_alloc_named_color_reply(nil_.con, cookie, 0);
+        if (q->cookie.sequence == 0) {
+            NIL_ERR("color format %s", str);
+            return -1;
+        }
+        reply = xcb_alloc_color_reply(nil_.con, q->cookie, 0);
         if (!reply) {
             NIL_ERR("no color %s", str);
             return -1;
@@ -381,8 +436,11 @@ void update_keys_mask() {
     key_caps  = get_keycode(XK_Caps_Lock);
     key_mode  = get_keycode(XK_Mode_switch);
 
-    reply = xcb_get_modifier_mapping_reply(nil_.con,
-        xcb_get_modifier_mapping_unchecked(nil_.con), 0);
+    reply = xcb_get_modifier_mapping_reply(nil_.con, boot_.modmap, 0);
+    if (!reply) {
+        NIL_ERR("no modifier mapping %u", boot_.modmap.sequence);
+        return;
+    }
     codes = xcb_get_modifier_mapping_keycodes(reply);
 
     /* The number of keycodes in the list is 8 * keycodes_per_modifier */
@@ -408,28 +466,13 @@ void update_keys_mask() {
     free(reply);
 }
 
+/** Send all startup requests, replies are read by the init_* functions
+ */
 static
-xcb_atom_t get_atom(const char *name) {
-    xcb_atom_t atom;
-    xcb_intern_atom_cookie_t cookie;
-    xcb_generic_error_t *err;
-    xcb_intern_atom_reply_t *reply;
-
-    cookie = xcb_intern_atom(nil_.con, 0, strlen(name), name);
-    reply = xcb_intern_atom_reply(nil_.con, cookie, &err);
-    if (!reply) {
-        NIL_ERR("intern atom %s", name);
-        return 0;
-    }
-    atom = reply->atom;
-    free(reply);
-    return atom;
-}
-
-static
-int init_screen() {
+void query_all() {
     uint32_t values;
-    xcb_void_cookie_t cookie;
+    xcb_font_t font;
+    unsigned int i;
 
     /* get the first screen */
     nil_.scr = xcb_setup_roots_iterator(xcb_get_setup(nil_.con)).data;
@@ -439,14 +482,60 @@ int init_screen() {
     /* Select for events, and at the same time, send SubstructureRedirect */
     values = XCB_EVENT_MASK_STRUCTURE_NOTIFY | XCB_EVENT_MASK_SUBSTRUCTURE_NOTIFY
         | XCB_EVENT_MASK_SUBSTRUCTURE_REDIRECT | XCB_EVENT_MASK_PROPERTY_CHANGE;
-
-    cookie = xcb_change_window_attributes_checked(nil_.con, nil_.scr->root,
+    boot_.redirect = xcb_change_window_attributes_checked(nil_.con, nil_.scr->root,
         XCB_CW_EVENT_MASK, &values);
-    if (xcb_request_check(nil_.con, cookie)) {
-        NIL_ERR("Another window manager is already running %u", cookie.sequence);
+    /* windows mapped after this are seen as MapRequest */
+    boot_.tree = xcb_query_tree_unchecked(nil_.con, nil_.scr->root);
+
+    /* keyboard mapping is requested by xcb_key_symbols_alloc */
+    nil_.key_syms = xcb_key_symbols_alloc(nil_.con);
+    boot_.modmap = xcb_get_modifier_mapping_unchecked(nil_.con);
+
+    for (i = 0; i < NIL_LEN(ATOMS_); ++i) {
+        boot_.atom[i] = xcb_intern_atom(nil_.con, 0, strlen(ATOMS_[i].name),
+            ATOMS_[i].name);
+    }
+    for (i = 0; i < NIL_LEN(COLORS_); ++i) {
+        query_color(*COLORS_[i].name, &boot_.color[i]);
+    }
+
+    /* cursors keep a reference to the font, it can be closed right away */
+    font = xcb_generate_id(nil_.con);
+    xcb_open_font(nil_.con, font, strlen(CURSOR_FONT_), CURSOR_FONT_);
+    for (i = 0; i < NUM_CURSOR; ++i) {
+        nil_.cursor[i] = xcb_generate_id(nil_.con);
+    }
+    boot_.cursor[CURSOR_NORMAL] = xcb_create_glyph_cursor_checked(nil_.con,
+        nil_.cursor[CURSOR_NORMAL], font, font, CURSOR_PTR_LEFT_,
+        CURSOR_PTR_LEFT_ + 1, 0, 0, 0, 0xFFFF, 0xFFFF, 0xFFFF);
+    boot_.cursor[CURSOR_MOVE] = xcb_create_glyph_cursor_checked(nil_.con,
+        nil_.cursor[CURSOR_MOVE], font, font, CURSOR_PTR_MOVE_,
+        CURSOR_PTR_MOVE_ + 1, 0, 0, 0, 0, 0, 0);
+    boot_.cursor[CURSOR_RESIZE] = xcb_create_glyph_cursor_checked(nil_.con,
+        nil_.cursor[CURSOR_RESIZE], font, font, CURSOR_PTR_RESIZE_,
+        CURSOR_PTR_RESIZE_ + 1, 0, 0, 0, 0, 0, 0);
+    xcb_close_font(nil_.con, font);
+
+    nil_.font.id = xcb_generate_id(nil_.con);
+    boot_.font = xcb_open_font_checked(nil_.con, nil_.font.id,
+        strlen(cfg_.font_name), cfg_.font_name);
+    boot_.font_info = xcb_query_font(nil_.con, nil_.font.id);
+}
+
+/** First reply of the startup, the others arrive with it
+ */
+static
+int init_screen() {
+    xcb_generic_error_t *err;
+
+    err = NIL_REPLY(xcb_request_check(nil_.con, boot_.redirect));
+    if (err) {
+        NIL_ERR("Another window manager is already running %u",
+            boot_.redirect.sequence);
+        free(err);
+        xcb_discard_reply(nil_.con, boot_.tree.sequence);
         return -1;
     }
-    /* TODO: set up all existing windows */
     return 0;
 }
 
@@ -456,7 +545,6 @@ int init_key() {
     const struct key_t *k;
     xcb_keycode_t key;
 
-    nil_.key_syms = xcb_key_symbols_alloc(nil_.con);
     update_keys_mask();
 
     xcb_ungrab_key(nil_.con, XCB_GRAB_ANY, nil_.scr->root, XCB_MOD_MASK_ANY);
@@ -474,88 +562,104 @@ int init_key() {
 
 /**
  * Grab mouse buttons.
+ * On workspace containers, so that the child of a press is the client.
  */
 static
 int init_mouse() {
-    /* left, middle and right mouse button */
-    GRAB_ALL_MOD_(GRAB_BUTTON_, nil_.scr->root, XCB_BUTTON_INDEX_1, cfg_.mod_key);
-    GRAB_ALL_MOD_(GRAB_BUTTON_, nil_.scr->root, XCB_BUTTON_INDEX_2, cfg_.mod_key);
-    GRAB_ALL_MOD_(GRAB_BUTTON_, nil_.scr->root, XCB_BUTTON_INDEX_3, cfg_.mod_key);
+    unsigned int i;
+    xcb_window_t win;
+
+    for (i = 0; i < cfg_.num_workspaces; ++i) {
+        win = nil_.ws[i].win;
+        /* left, middle and right mouse button */
+        GRAB_ALL_MOD_(GRAB_BUTTON_, win, XCB_BUTTON_INDEX_1, cfg_.mod_key);
+        GRAB_ALL_MOD_(GRAB_BUTTON_, win, XCB_BUTTON_INDEX_2, cfg_.mod_key);
+        GRAB_ALL_MOD_(GRAB_BUTTON_, win, XCB_BUTTON_INDEX_3, cfg_.mod_key);
+    }
     return 0;
 }
 
 static
 int init_cursor() {
-    xcb_font_t font;
-    xcb_void_cookie_t cookie;
     xcb_generic_error_t *error;
+    unsigned int i;
 
-    font = xcb_generate_id(nil_.con);
-    xcb_open_font(nil_.con, font, strlen(CURSOR_FONT_), CURSOR_FONT_);
-
-    nil_.cursor[CURSOR_NORMAL] = xcb_generate_id(nil_.con);
-    cookie = xcb_create_glyph_cursor_checked(nil_.con, nil_.cursor[CURSOR_NORMAL],
-        font, font, CURSOR_PTR_LEFT_, CURSOR_PTR_LEFT_ + 1,
-        0, 0, 0, 0xFFFF, 0xFFFF, 0xFFFF);
-    error = xcb_request_check(nil_.con, cookie);
-    if (error) {
-        NIL_ERR("create cursor %d %d", CURSOR_PTR_LEFT_, error->error_code);
-        xcb_close_font(nil_.con, font);
-        return -1;
-    }
-    nil_.cursor[CURSOR_MOVE] = xcb_generate_id(nil_.con);
-    cookie = xcb_create_glyph_cursor_checked(nil_.con, nil_.cursor[CURSOR_NORMAL],
-        font, font, CURSOR_PTR_MOVE_, CURSOR_PTR_MOVE_ + 1, 0, 0, 0, 0, 0, 0);
-    error = xcb_request_check(nil_.con, cookie);
-    if (error) {
-        NIL_ERR("create cursor %d %d", CURSOR_PTR_MOVE_, error->error_code);
-        nil_.cursor[CURSOR_MOVE] = nil_.cursor[CURSOR_NORMAL];
-    }
-    nil_.cursor[CURSOR_RESIZE] = xcb_generate_id(nil_.con);
-    cookie = xcb_create_glyph_cursor_checked(nil_.con, nil_.cursor[CURSOR_NORMAL],
-        font, font, CURSOR_PTR_RESIZE_, CURSOR_PTR_RESIZE_ + 1, 0, 0, 0, 0, 0, 0);
-    error = xcb_request_check(nil_.con, cookie);
-    if (error) {
-        NIL_ERR("create cursor %d %d", CURSOR_PTR_RESIZE_, error->error_code);
-        nil_.cursor[CURSOR_RESIZE] = nil_.cursor[CURSOR_NORMAL];
+    for (i = 0; i < NUM_CURSOR; ++i) {
+        error = xcb_request_check(nil_.con, boot_.cursor[i]);
+        if (!error) {
+            continue;
+        }
+        NIL_ERR("create cursor %u %d", i, error->error_code);
+        free(error);
+        if (i == CURSOR_NORMAL) {
+            nil_.cursor[i] = 0;
+            return -1;
+        }
+        nil_.cursor[i] = nil_.cursor[CURSOR_NORMAL];
     }
-    xcb_close_font(nil_.con, font);
     return 0;
 }
 
 static
 int init_color() {
-    if ((get_color(cfg_.border_color, &nil_.color.border) != 0)
-        || (get_color(cfg_.focus_color, &nil_.color.focus) != 0)
-        || (get_color(cfg_.bar_bg_color, &nil_.color.bar_bg) != 0)
-        || (get_color(cfg_.bar_fg_color, &nil_.color.bar_fg) != 0)
-        || (get_color(cfg_.bar_sel_color, &nil_.color.bar_sel) != 0)
-        || (get_color(cfg_.bar_occ_color, &nil_.color.bar_occ) != 0)
-        || (get_color(cfg_.bar_urg_color, &nil_.color.bar_urg) != 0)) {
+    unsigned int i;
+    int ret;
+
+    ret = 0;
+    /* read all replies even if one fails */
+    for (i = 0; i < NIL_LEN(COLORS_); ++i) {
+        if (get_color(*COLORS_[i].name, &boot_.color[i], COLORS_[i].pixel) != 0) {
+            ret = -1;
+        }
+    }
+    return ret;
+}
+
+/** Width of a character of the font
+ * 8-bit text uses the first row of a matrix font.
+ * @return -1 if the font lacks it
+ */
+static
+int get_char_width(const xcb_query_font_reply_t *info, unsigned int code) {
+    const xcb_charinfo_t *c;
+    unsigned int n, idx;
+
+    if ((info->min_byte1 != 0) || (code < info->min_char_or_byte2)
+        || (code > info->max_char_or_byte2)) {
         return -1;
     }
-    return 0;
+    n = xcb_query_font_char_infos_length(info);
+    if (n == 0) {                   /* all characters have the same metrics */
+        return info->max_bounds.character_width;
+    }
+    idx = code - info->min_char_or_byte2;
+    if (idx >= n) {
+        return -1;
+    }
+    c = &xcb_query_font_char_infos(info)[idx];
+    if (!c->left_side_bearing && !c->right_side_bearing && !c->character_width
+        && !c->ascent && !c->descent && !c->attributes) {
+        return -1;                  /* nonexistent character */
+    }
+    return c->character_width;
 }
 
 static
 int init_font() {
-    xcb_void_cookie_t cookie;
     xcb_generic_error_t *err;
-    xcb_list_fonts_with_info_cookie_t info_cookie;
-    xcb_list_fonts_with_info_reply_t *info;
+    xcb_query_font_reply_t *info;
+    unsigned int i;
+    int w, def;
 
-    /* open font */
-    nil_.font.id = xcb_generate_id(nil_.con);
-    cookie = xcb_open_font_checked(nil_.con, nil_.font.id,
-        strlen(cfg_.font_name), cfg_.font_name);
-    err = xcb_request_check(nil_.con, cookie);
+    err = xcb_request_check(nil_.con, boot_.font);
     if (err) {
         NIL_ERR("open font: %d", err->error_code);
+        free(err);
+        xcb_discard_reply(nil_.con, boot_.font_info.sequence);
+        nil_.font.id = 0;
         return -1;
     }
-    info_cookie = xcb_list_fonts_with_info(nil_.con, 1,
-        strlen(cfg_.font_name), cfg_.font_name);
-    info = xcb_list_fonts_with_info_reply(nil_.con, info_cookie, 0);
+    info = xcb_query_font_reply(nil_.con, boot_.font_info, 0);
     if (!info) {
         NIL_ERR("load font: %s", cfg_.font_name);
         return -1;
@@ -563,6 +667,12 @@ int init_font() {
     NIL_LOG("font ascent=%d, descent=%d", info->font_ascent, info->font_descent);
     nil_.font.ascent = info->font_ascent;
     nil_.font.descent = info->font_descent;
+    /* missing characters are drawn as the default one, or not at all */
+    def = get_char_width(info, info->default_char);
+    for (i = 0; i < NUM_GLYPH; ++i) {
+        w = get_char_width(info, i);
+        nil_.font.width[i] = (w >= 0) ? w : ((def >= 0) ? def : 0);
+    }
     free(info);
     return 0;
 }
@@ -570,8 +680,10 @@ int init_font() {
 static
 int init_bar() {
     uint32_t vals[4];
-    xcb_void_cookie_t cookie;
+    const uint32_t *colors[NUM_SCHEME];
+    xcb_void_cookie_t cookie[3 + NUM_SCHEME * 2];
     xcb_generic_error_t *err;
+    unsigned int i;
 
     /* create status bar window at the bottom */
     bar_.w = nil_.scr->width_in_pixels;
@@ -584,46 +696,86 @@ int init_bar() {
     vals[2] = XCB_EVENT_MASK_BUTTON_PRESS | XCB_EVENT_MASK_EXPOSURE;
     vals[3] = nil_.cursor[CURSOR_NORMAL];
 
-    cookie = xcb_create_window_checked(nil_.con, nil_.scr->root_depth, bar_.win,
+    cookie[0] = xcb_create_window_checked(nil_.con, nil_.scr->root_depth, bar_.win,
         nil_.scr->root, bar_.x, bar_.y, bar_.w, bar_.h, 0, XCB_COPY_FROM_PARENT,
         nil_.scr->root_visual, XCB_CW_BACK_PIXMAP | XCB_CW_OVERRIDE_REDIRECT
         | XCB_CW_EVENT_MASK | XCB_CW_CURSOR, vals);
-    err = xcb_request_check(nil_.con, cookie);
-    if (err) {
-        NIL_ERR("create window %d", err->error_code);
-        return -1;
-    }
     vals[0] = XCB_STACK_MODE_ABOVE;
     xcb_configure_window(nil_.con, bar_.win, XCB_CONFIG_WINDOW_STACK_MODE, &vals[0]);
-    cookie = xcb_map_window_checked(nil_.con, bar_.win);
-    err = xcb_request_check(nil_.con, cookie);
-    if (err) {
-        NIL_ERR("map window %d", err->error_code);
-        return -1;
+    cookie[1] = xcb_map_window_checked(nil_.con, bar_.win);
+    /* back buffer */
+    bar_.pixmap = xcb_generate_id(nil_.con);
+    cookie[2] = xcb_create_pixmap_checked(nil_.con, nil_.scr->root_depth,
+        bar_.pixmap, bar_.win, bar_.w, bar_.h);
+    /* graphic contexts, colors never change afterwards */
+    colors[SCHEME_NORMAL] = &nil_.color.bar_bg;
+    colors[SCHEME_SEL] = &nil_.color.bar_sel;
+    colors[SCHEME_OCC] = &nil_.color.bar_occ;
+    colors[SCHEME_URG] = &nil_.color.bar_urg;
+    for (i = 0; i < NUM_SCHEME; ++i) {
+        bar_.scheme[i].fill = xcb_generate_id(nil_.con);
+        vals[0] = *colors[i];
+        vals[1] = 0;    /* no graphics exposures */
+        cookie[3 + i * 2] = xcb_create_gc_checked(nil_.con, bar_.scheme[i].fill,
+            bar_.pixmap, XCB_GC_FOREGROUND | XCB_GC_GRAPHICS_EXPOSURES, vals);
+        bar_.scheme[i].text = xcb_generate_id(nil_.con);
+        vals[0] = nil_.color.bar_fg;
+        vals[1] = *colors[i];
+        vals[2] = nil_.font.id;
+        cookie[4 + i * 2] = xcb_create_gc_checked(nil_.con, bar_.scheme[i].text,
+            bar_.pixmap, XCB_GC_FOREGROUND | XCB_GC_BACKGROUND | XCB_GC_FONT, vals);
     }
-    /* graphic context */
-    bar_.gc = xcb_generate_id(nil_.con);
-    vals[0] = nil_.color.bar_fg;
-    vals[1] = nil_.color.bar_bg;
-    vals[2] = nil_.font.id;
-    cookie = xcb_create_gc_checked(nil_.con, bar_.gc, bar_.win, XCB_GC_FOREGROUND
-        | XCB_GC_BACKGROUND | XCB_GC_FONT, vals);
-    err = xcb_request_check(nil_.con, cookie);
-    if (err) {
-        NIL_ERR("map window %d", err->error_code);
-        return -1;
+    /* one round trip checks all of them */
+    for (i = 0; i < NIL_LEN(cookie); ++i) {
+        err = (i == 0) ? NIL_REPLY(xcb_request_check(nil_.con, cookie[i]))
+            : xcb_request_check(nil_.con, cookie[i]);
+        if (err) {
+            NIL_ERR("init bar %u %d", i, err->error_code);
+            free(err);
+            return -1;
+        }
     }
+    /* drawn and shown by the events loop */
+    config_bar();
+    update_bar_status();
     return 0;
 }
 
+/** Create a container window for each workspace, the current one is mapped
+ * Containers cover the screen below the bar and redirect requests of their
+ * clients like the root, so switching workspace maps and unmaps only them.
+ * On exit, release_clients moves clients back to the root before they are
+ * destroyed.
+ */
 static
-int init_wm() {
-    struct sigaction act;
+void init_containers() {
+    uint32_t vals[4];
+    unsigned int i;
 
-    sigemptyset(&act.sa_mask);
-    act.sa_flags = 0;
-    act.sa_handler = &handle_signal;
-    sigaction(SIGCHLD, &act, 0);
+    vals[0] = XCB_BACK_PIXMAP_PARENT_RELATIVE;
+    vals[1] = 1;    /* override_redirect, never adopted as a client */
+    vals[2] = XCB_EVENT_MASK_SUBSTRUCTURE_NOTIFY
+        | XCB_EVENT_MASK_SUBSTRUCTURE_REDIRECT;
+    vals[3] = nil_.cursor[CURSOR_NORMAL];
+    for (i = 0; i < cfg_.num_workspaces; ++i) {
+        nil_.ws[i].win = xcb_generate_id(nil_.con);
+        xcb_create_window(nil_.con, nil_.scr->root_depth, nil_.ws[i].win,
+            nil_.scr->root, 0, 0, nil_.scr->width_in_pixels,
+            nil_.scr->height_in_pixels, 0, XCB_WINDOW_CLASS_INPUT_OUTPUT,
+            nil_.scr->root_visual, XCB_CW_BACK_PIXMAP | XCB_CW_OVERRIDE_REDIRECT
+            | XCB_CW_EVENT_MASK | XCB_CW_CURSOR, vals);
+        vals[0] = XCB_STACK_MODE_BELOW;
+        xcb_configure_window(nil_.con, nil_.ws[i].win,
+            XCB_CONFIG_WINDOW_STACK_MODE, &vals[0]);
+        vals[0] = XCB_BACK_PIXMAP_PARENT_RELATIVE;
+    }
+    xcb_map_window(nil_.con, nil_.ws[nil_.ws_idx].win);
+}
+
+static
+int init_wm() {
+    xcb_intern_atom_reply_t *reply;
+    unsigned int i;
 
     /* alloc workspaces */
     nil_.ws = malloc(sizeof(struct workspace_t) * cfg_.num_workspaces);
@@ -644,18 +796,133 @@ int init_wm() {
     nil_.w = nil_.scr->width_in_pixels;
     nil_.h = nil_.scr->height_in_pixels - bar_.h;
     NIL_LOG("workspace %d,%d %ux%u", nil_.x, nil_.y, nil_.w, nil_.h);
+    init_containers();
 
     /* init atoms */
-    nil_.atom.net_supported = get_atom("_NET_SUPPORTED");
-    nil_.atom.net_wm_name   = get_atom("_NET_WM_NAME");
-    nil_.atom.wm_protocols  = get_atom("WM_PROTOCOLS");
-    nil_.atom.wm_delete     = get_atom("WM_DELETE_WINDOW");
-    nil_.atom.wm_state      = get_atom("WM_STATE");
+    for (i = 0; i < NIL_LEN(ATOMS_); ++i) {
+        reply = xcb_intern_atom_reply(nil_.con, boot_.atom[i], 0);
+        if (!reply) {
+            NIL_ERR("intern atom %s", ATOMS_[i].name);
+            *ATOMS_[i].atom = 0;
+            continue;
+        }
+        *ATOMS_[i].atom = reply->atom;
+        free(reply);
+    }
+    return 0;
+}
+
+/** Windows created by the wm itself
+ */
+static
+int is_own_window(xcb_window_t win) {
+    unsigned int i;
+
+    if (win == bar_.win) {
+        return 1;
+    }
+    for (i = 0; i < cfg_.num_workspaces; ++i) {
+        if (win == nil_.ws[i].win) {
+            return 1;
+        }
+    }
+    return 0;
+}
+
+/** Give clients back to the root, mapped where they are on the screen
+ * Containers are at the origin of the screen, so positions are kept. Clients
+ * of hidden workspaces or hidden by monocle are mapped too, so that the next
+ * wm adopts them all.
+ */
+static
+void release_clients() {
+    struct client_t *c;
+    unsigned int i;
+
+    for (i = 0; i < cfg_.num_workspaces; ++i) {
+        for (c = nil_.ws[i].first; c; c = c->next) {
+            xcb_reparent_window(nil_.con, c->win, nil_.scr->root, c->geom.x,
+                c->geom.y);
+            xcb_map_window(nil_.con, c->win);
+        }
+        if (nil_.ws[i].win) {
+            xcb_destroy_window(nil_.con, nil_.ws[i].win);
+        }
+    }
+}
+
+/** Manage windows which already exist, e.g. after a restart
+ * Requests for all windows are sent in one batch before reading any reply.
+ */
+static
+int init_clients() {
+    xcb_query_tree_reply_t *tree;
+    xcb_window_t *wins;
+    struct client_query_t *q;
+    struct client_t *c;
+    struct workspace_t *ws;
+    int i, n, num;
+
+    tree = xcb_query_tree_reply(nil_.con, boot_.tree, 0);
+    if (!tree) {
+        NIL_ERR("query tree %d", nil_.scr->root);
+        return 0;
+    }
+    n = xcb_query_tree_children_length(tree);
+    wins = xcb_query_tree_children(tree);
+    q = malloc(sizeof(struct client_query_t) * n);
+    if (!q) {
+        NIL_ERR("out of mem %d", n);
+        free(tree);
+        return -1;
+    }
+    for (i = 0; i < n; ++i) {
+        if (!is_own_window(wins[i])) {
+            (*nil_.be->query_window)(wins[i], &q[i]);
+        }
+    }
+    ws = &nil_.ws[nil_.ws_idx];
+    num = 0;
+    ++stats_.round_trips;   /* all replies come back together */
+    for (i = 0; i < n; ++i) {
+        if (is_own_window(wins[i])) {
+            continue;
+        }
+        c = alloc_client(wins[i]);
+        if (!c) {
+            (*nil_.be->discard_window)(&q[i]);
+            continue;
+        }
+        /* only windows which are shown */
+        if ((init_client(c, &q[i]) != 0)
+            || (c->map_state != XCB_MAP_STATE_VIEWABLE)) {
+            free_client(c);
+            continue;
+        }
+        NIL_SET_FLAG(c->flags, CLIENT_DISPLAY | CLIENT_MAPPED);
+        attach_client(c, ws);
+        (*nil_.be->change_save_set)(XCB_SET_MODE_INSERT, c->win);
+        reparent_client(c, ws);
+        config_client(c);
+        ++num;
+    }
+    NIL_LOG("adopted %d of %d windows", num, n);
+    if (num > 0) {
+        arrange_ws(ws);
+    }
+    free(q);
+    free(tree);
     return 0;
 }
 
 static
 void cleanup() {
+    unsigned int i;
+
+    stop_record();
+    stop_modules();
+    cleanup_bar();
+    cleanup_loop();
     if (nil_.key_syms) {
         xcb_key_symbols_free(nil_.key_syms);
     }
@@ -673,21 +940,52 @@ void cleanup() {
         && (nil_.cursor[CURSOR_RESIZE] != nil_.cursor[CURSOR_NORMAL])) {
         xcb_free_cursor(nil_.con, nil_.cursor[CURSOR_RESIZE]);
     }
+    for (i = 0; i < NUM_SCHEME; ++i) {
+        if (bar_.scheme[i].fill) {
+            xcb_free_gc(nil_.con, bar_.scheme[i].fill);
+        }
+        if (bar_.scheme[i].text) {
+            xcb_free_gc(nil_.con, bar_.scheme[i].text);
+        }
+    }
+    if (bar_.pixmap) {
+        xcb_free_pixmap(nil_.con, bar_.pixmap);
+    }
     if (bar_.win) {
         xcb_destroy_window(nil_.con, bar_.win);
     }
     xcb_ungrab_keyboard(nil_.con, XCB_TIME_CURRENT_TIME);
-    xcb_destroy_subwindows(nil_.con, nil_.scr->root);
+    if (nil_.ws) {
+        release_clients();
+    }
     xcb_flush(nil_.con);
     xcb_disconnect(nil_.con);
     if (nil_.ws) {
+        cleanup_clients();
         free(nil_.ws);
     }
 }
 
 int main(int argc, char **argv) {
-    (void)argc;
-    (void)argv;
+    const char *record;
+    int opt, phases;
+
+    record = 0;
+    phases = 0;
+    while ((opt = getopt(argc, argv, "tr:")) != -1) {
+        switch (opt) {
+        case 't':
+            phases = 1;
+            break;
+        case 'r':
+            record = optarg;
+            break;
+        default:
+            fprintf(stderr, "usage: %s [-t] [-r file]\n", argv[0]);
+            exit(1);
+        }
+    }
+    start_phases(phases);
 
     /* open connection with the server */
     nil_.con = xcb_connect(0, 0);
@@ -695,14 +993,58 @@ int main(int argc, char **argv) {
         NIL_ERR("xcb_connect %p", (void *)nil_.con);
         exit(1);
     }
+    end_phase("connect");
+    /* every request goes out before waiting on the first reply */
+    query_all();
+    end_phase("request");
     /* 1st stage */
-    if ((init_screen() != 0) || (init_key() != 0) || (init_mouse() != 0)) {
+    if (init_screen() != 0) {
         xcb_disconnect(nil_.con);
         exit(1);
     }
+    end_phase("screen");
     /* 2nd stage */
-    if ((init_cursor() != 0) || (init_color() != 0) != (init_font() != 0)
-        || (init_bar() != 0) || (init_wm() != 0))  {
+    if (init_key() != 0) {
+        cleanup();
+        exit(1);
+    }
+    end_phase("key");
+    if (init_cursor() != 0) {
+        cleanup();
+        exit(1);
+    }
+    end_phase("cursor");
+    if (init_color() != 0) {
+        cleanup();
+        exit(1);
+    }
+    end_phase("color");
+    if (init_font() != 0) {
+        cleanup();
+        exit(1);
+    }
+    end_phase("font");
+    if (init_bar() != 0) {
+        cleanup();
+        exit(1);
+    }
+    end_phase("bar");
+    if ((init_wm() != 0) || (init_mouse() != 0) || (init_loop() != 0))  {
+        cleanup();
+        exit(1);
+    }
+    open_bar_status();      /* falls back to WM_NAME, unless modules */
+    if (start_modules() != 0) {
+        cleanup();
+        exit(1);
+    }
+    end_phase("wm");
+    if (init_clients() != 0) {
+        cleanup();
+        exit(1);
+    }
+    end_phase("clients");
+    if (record && (start_record(record) != 0)) {
         cleanup();
         exit(1);
     }
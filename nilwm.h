@@ -27,6 +27,16 @@
 #define NIL_UNUSED(x)           _ ## x __attribute__((unused))
 #define NIL_LEN(x)              (sizeof(x) / sizeof((x)[0]))
 
+/* wait for a reply, counted as a round trip */
+#define NIL_REPLY(x)            (++stats_.round_trips, (x))
+
+#define PHASE_FIRST_WINDOW      "first window"
+
+#define NIL_EVENT_SIZE          32      /* core events, without full_sequence */
+
+#define RECORD_MAGIC            0x524c494eu     /* "NILR" */
+#define RECORD_VERSION          8
+
 #define NIL_HAS_FLAG(x, f)      ((x) & (f))
 #define NIL_SET_FLAG(x, f)      (x) |= (f)
 #define NIL_CLEAR_FLAG(x, f)    (x) &= ~(f)
@@ -38,6 +48,7 @@ extern "C" {
 enum {                              /* workspace layout type */
     LAYOUT_TILE         = 0,
     LAYOUT_FREE,
+    LAYOUT_MONO,
     NUM_LAYOUT,
 };
 
@@ -47,6 +58,17 @@ enum {                              /* client flags */
     CLIENT_FLOAT        = 1 << 2,   /* float mode */
     CLIENT_FIXED        = 1 << 3,   /* size fixed (min = max) */
     CLIENT_FOCUS        = 1 << 4,   /* already focused */
+    CLIENT_DELETE       = 1 << 5,   /* supports WM_DELETE_WINDOW */
+    CLIENT_PENDING      = 1 << 6,   /* map deferred until arranged */
+    CLIENT_HIDDEN       = 1 << 7,   /* unmapped by monocle layout */
+    CLIENT_TITLE        = 1 << 8,   /* title to fetch, see mark_title */
+    CLIENT_NET_NAME     = 1 << 9,   /* title from _NET_WM_NAME */
+};
+
+enum {                              /* workspace flags */
+    WS_DIRTY            = 1 << 0,   /* needs to be arranged */
+    WS_PENDING          = 1 << 1,   /* has clients waiting to be mapped */
+    WS_CYCLE            = 1 << 2,   /* cycling the focus history */
 };
 
 enum {                              /* for focus/swap */
@@ -71,6 +93,28 @@ enum {                              /* box flags */
     BOX_TEXT_LEFT       = 0 << 2,   /* 2 bits for text alignment */
     BOX_TEXT_RIGHT      = 1 << 2,
     BOX_TEXT_CENTER     = 2 << 2,
+    BOX_DIRTY           = 1 << 4,   /* redrawn by draw_bar */
+};
+
+enum {                              /* bar color schemes */
+    SCHEME_NORMAL       = 0,
+    SCHEME_SEL,
+    SCHEME_OCC,
+    SCHEME_URG,
+    NUM_SCHEME,
+};
+
+enum {                              /* watch flags */
+    WATCH_TIMER         = 1 << 0,   /* fd is a timerfd */
+};
+
+enum {                              /* font sizes */
+    NUM_GLYPH           = 256,      /* text is drawn with 8-bit characters */
+};
+
+enum {                              /* stats sizes */
+    NUM_HIST            = 16,       /* latency buckets, bucket i is < 2^i us */
+    NUM_EVENT_TYPE      = XCB_GE_GENERIC + 1,
 };
 
 enum {
@@ -80,20 +124,212 @@ enum {
     NUM_CURSOR,
 };
 
+struct geom_t {
+    int16_t x, y;
+    uint16_t w, h;
+};
+
+/* growable text, see reserve_text */
+struct text_t {
+    char *s;                        /* null terminated */
+    unsigned int len;
+    unsigned int size;              /* allocated */
+};
+
 /* window wrapper */
 struct client_t {
     xcb_window_t win;
-    int16_t x, y;
+    int16_t x, y;                   /* wanted geometry */
     uint16_t w, h;
+    struct geom_t geom;             /* geometry known by the server */
     uint16_t min_w, min_h;
     uint16_t max_w, max_h;
     uint16_t border_width;
-    char *title;
+    struct text_t title;            /* cached, see poll_titles */
     int map_state;
     unsigned int tags;
     unsigned int flags;
+    struct workspace_t *ws;         /* workspace it is attached to */
+    struct client_t *hash_next;     /* next in the window index bucket */
     struct client_t *next;
     struct client_t **prev;
+    struct client_t *mru_next;      /* focus history of its workspace */
+    struct client_t **mru_prev;     /* 0 if not in it */
+    struct client_t *gmru_next;     /* focus history of all workspaces */
+    struct client_t **gmru_prev;
+    struct client_t *title_next;    /* marked titles, see mark_title */
+    struct client_t **title_prev;
+};
+
+/* requests sent to manage a window, see backend_t.query_window */
+struct client_query_t {
+    xcb_window_t win;
+    xcb_get_window_attributes_cookie_t attr;
+    xcb_get_geometry_cookie_t geom;
+    xcb_get_property_cookie_t hints;
+    xcb_get_property_cookie_t proto;
+    xcb_get_property_cookie_t name;
+    xcb_get_property_cookie_t net_name;
+};
+
+/* what the server knows of a window, see backend_t.read_window */
+struct window_info_t {
+    uint8_t override_redirect;
+    uint8_t map_state;
+    uint8_t has_geom;
+    uint8_t wm_delete;              /* supports WM_DELETE_WINDOW */
+    uint8_t net_name;               /* title from _NET_WM_NAME */
+    struct geom_t geom;
+    uint16_t min_w, min_h;          /* size hints, 0 if not set */
+    uint16_t max_w, max_h;
+    char *title;                    /* allocated, 0 if not set */
+};
+
+/* requests issued once the wm is running
+ * Startup talks to the server directly, everything else goes through a
+ * backend so that it can be counted or replaced by the mock in mock.c.
+ */
+struct backend_t {
+    const char *name;
+    /* connection */
+    int (*get_fd)();
+    int (*has_error)();
+    int (*flush)();
+    unsigned int (*no_operation)(); /* sequence number of the request */
+    xcb_generic_event_t *(*poll_event)();
+    xcb_generic_event_t *(*poll_queued_event)();
+    /* windows */
+    void (*query_window)(xcb_window_t win, struct client_query_t *q);
+    void (*discard_window)(struct client_query_t *q);
+    int (*read_window)(struct client_query_t *q, struct window_info_t *info);
+    void (*configure_window)(xcb_window_t win, uint16_t mask,
+        const uint32_t *vals);
+    void (*change_window_attributes)(xcb_window_t win, uint32_t mask,
+        const uint32_t *vals);
+    void (*map_window)(xcb_window_t win);
+    void (*unmap_window)(xcb_window_t win);
+    void (*reparent_window)(xcb_window_t win, xcb_window_t parent, int16_t x,
+        int16_t y);
+    void (*change_save_set)(uint8_t mode, xcb_window_t win);
+    void (*set_input_focus)(xcb_window_t win);
+    void (*send_event)(xcb_window_t win, const char *e);
+    void (*kill_client)(xcb_window_t win);
+    /* pointer */
+    void (*grab_pointer)(xcb_cursor_t cursor);
+    void (*ungrab_pointer)();
+    void (*warp_pointer)(xcb_window_t win, int16_t x, int16_t y);
+    void (*allow_events)(uint8_t mode, xcb_timestamp_t time);
+    /* drawing */
+    void (*fill_rectangle)(xcb_drawable_t d, xcb_gcontext_t gc,
+        const xcb_rectangle_t *rect);
+    void (*draw_text)(xcb_drawable_t d, xcb_gcontext_t gc, int16_t x,
+        int16_t y, const char *str, uint8_t len);
+    void (*copy_area)(xcb_drawable_t src, xcb_drawable_t dst,
+        xcb_gcontext_t gc, const xcb_rectangle_t *rect);
+    unsigned int (*query_text_property)(xcb_window_t win, xcb_atom_t atom);
+    int (*poll_text_property)(unsigned int seq, struct text_t *t);
+                                    /* 0 until the reply, -1 if none */
+    /* keyboard */
+    void (*grab_keyboard)();
+    void (*ungrab_keyboard)();
+    xcb_keysym_t (*lookup_keysym)(xcb_keycode_t code, int col);
+};
+
+struct atom_t {
+    xcb_atom_t net_supported;
+    xcb_atom_t net_wm_name;
+    xcb_atom_t wm_protocols;
+    xcb_atom_t wm_delete;
+    xcb_atom_t wm_state;
+    xcb_atom_t utf8_string;
+};
+
+struct font_t {
+    xcb_font_t id;
+    uint16_t ascent;
+    uint16_t descent;
+    int16_t width[NUM_GLYPH];       /* of each 8-bit character, see init_font */
+};
+
+/* Recorded session, see record.c
+ * A header, the workspaces and the clients managed when recording started,
+ * the focus histories, then a stream of records, each one a tag byte followed
+ * by its payload. A history is a uint32_t count then the windows most recent
+ * first, the one of each workspace then the global one.
+ * Numbers are in host order, a trace is replayed on the same kind of host.
+ */
+enum {                              /* record tags */
+    REC_EVENT           = 1,        /* 32 bytes event */
+    REC_FLUSH,                      /* end of a loop iteration */
+    REC_WINDOW,                     /* rec_window_t then the title */
+    REC_KEYSYM,                     /* xcb_keysym_t */
+    REC_TEXT_PROP,                  /* int32_t result, if 1 uint32_t length
+                                     * then the text */
+};
+
+struct rec_header_t {
+    uint32_t magic;
+    uint32_t version;
+    uint32_t num_workspaces;
+    uint32_t num_clients;
+    uint32_t ws_idx;
+    xcb_window_t root;
+    uint16_t scr_w, scr_h;
+    int16_t x, y;                   /* area for clients */
+    uint16_t w, h;
+    xcb_window_t bar_win;
+    xcb_pixmap_t bar_pixmap;
+    int16_t bar_x, bar_y;
+    uint16_t bar_w, bar_h;
+    struct font_t font;             /* text is measured with it */
+    struct atom_t atom;
+    uint16_t mask_numlock;
+    uint16_t mask_capslock;
+    uint16_t mask_shiftlock;
+    uint16_t mask_modeswitch;
+};
+
+struct rec_ws_t {
+    uint32_t layout;
+    uint32_t master_size;
+    xcb_window_t focus;
+    xcb_window_t win;
+    uint32_t flags;
+    xcb_window_t cycle;             /* history position while cycling */
+};
+
+struct rec_client_t {
+    xcb_window_t win;
+    uint32_t ws;
+    uint32_t flags;
+    int16_t x, y;
+    uint16_t w, h;
+    struct geom_t geom;
+    uint16_t min_w, min_h;
+    uint16_t max_w, max_h;
+    uint16_t border_width;
+    uint16_t title_len;             /* followed by the title */
+};
+
+struct rec_window_t {
+    xcb_window_t win;
+    int32_t ret;                    /* of read_window */
+    uint8_t override_redirect;
+    uint8_t map_state;
+    uint8_t has_geom;
+    uint8_t wm_delete;
+    uint8_t net_name;
+    struct geom_t geom;
+    uint16_t min_w, min_h;
+    uint16_t max_w, max_h;
+    uint16_t title_len;
+};
+
+/* a request seen by the mock backend */
+struct mock_request_t {
+    uint8_t type;                   /* major opcode */
+    xcb_window_t win;
+    uint32_t mask;                  /* value mask if any */
 };
 
 struct bar_box_t {
@@ -103,30 +339,59 @@ struct bar_box_t {
     unsigned int flags;
 };
 
+/* graphic contexts of a bar color scheme, created once */
+struct scheme_t {
+    xcb_gcontext_t fill;            /* foreground is the background color */
+    xcb_gcontext_t text;
+};
+
 /* info bar */
 struct bar_t {
     xcb_window_t win;
-    xcb_gcontext_t gc;
+    xcb_pixmap_t pixmap;            /* back buffer, see bar.c */
+    struct scheme_t scheme[NUM_SCHEME];
     int16_t x, y;
     uint16_t w, h;
     struct bar_box_t box[NUM_BAR];
 };
 
+/* file descriptor watched by the events loop */
+struct watch_t {
+    int fd;
+    unsigned int flags;
+    void (*func)(struct watch_t *self);
+    void *data;
+};
+
+/* handler latency histogram of an event type */
+struct hist_t {
+    unsigned long count;
+    unsigned long total;            /* us */
+    unsigned long max;              /* us */
+    unsigned long bucket[NUM_HIST];
+};
+
+/* event loop and X traffic counters */
+struct stats_t {
+    unsigned long wakeups;          /* returns from blocking wait */
+    unsigned long events;           /* events dispatched */
+    unsigned long flushes;          /* explicit flushes (one per batch) */
+    unsigned long requests;         /* requests issued */
+    unsigned long round_trips;      /* replies waited on */
+    unsigned long replies;          /* title and status replies polled */
+    unsigned int max_batch;         /* largest number of events in a batch */
+    struct hist_t event[NUM_EVENT_TYPE];
+};
+
 struct mouse_event_t {
     int mode;   /* is also CURSOR */
     struct client_t *client;
     struct workspace_t *ws;
-    int16_t x1, y1;
-    int16_t x2, y2;
+    int16_t x1, y1;     /* position already applied */
+    int16_t x2, y2;     /* latest position */
 };
 
 /* font information */
-struct font_t {
-    xcb_font_t id;
-    uint16_t ascent;
-    uint16_t descent;
-};
-
 /* colors from user's configuration */
 struct color_t {
     uint32_t border;
@@ -159,17 +424,31 @@ struct workspace_t {
     struct client_t *focus;
     int layout;
     int master_size;
+    unsigned int flags;
+    xcb_window_t win;               /* container its clients live in */
+    struct client_t *mru;           /* most recently focused first */
+    struct client_t *cycle;         /* history position while cycling */
 };
 
 struct layout_t {
     const char *symbol;
     void (*arrange)(struct workspace_t *);
     void (*focus)(struct workspace_t *, int dir);
+    void (*select)(struct workspace_t *, struct client_t *c);
     void (*swap)(struct workspace_t *, int dir);
     void (*move)(struct workspace_t *, struct mouse_event_t *e);
     void (*resize)(struct workspace_t *, struct mouse_event_t *e);
 };
 
+/* built-in status module, see status.c */
+struct module_state_t;
+struct module_t {
+    int (*func)(struct module_state_t *self, char *s, int len);
+                                    /* length of s, -1 if unknown */
+    unsigned int interval;          /* ms between refreshes */
+    const char *arg;
+};
+
 struct config_t {
     uint16_t border_width;
     unsigned int num_workspaces;
@@ -178,7 +457,14 @@ struct config_t {
     unsigned int keys_len;
 
     unsigned int master_size;       /* master factor */
+    unsigned int motion_interval;   /* min time between drag updates (ms) */
+    unsigned int status_interval;   /* min time between status fetches (ms) */
+    unsigned int title_interval;    /* min time between title fetches (ms) */
     const char *font_name;
+    const char *stats_file;         /* written on SIGUSR1, stderr if null */
+    const char *status_fifo;        /* status lines, root WM_NAME if null */
+    const struct module_t *modules;
+    unsigned int modules_len;       /* status from modules if not 0 */
 
     const char *border_color;
     const char *focus_color;
@@ -189,16 +475,9 @@ struct config_t {
     const char *bar_urg_color;
 };
 
-struct atom_t {
-    xcb_atom_t net_supported;
-    xcb_atom_t net_wm_name;
-    xcb_atom_t wm_protocols;
-    xcb_atom_t wm_delete;
-    xcb_atom_t wm_state;
-};
-
 struct nilwm_t {
     xcb_connection_t *con;
+    const struct backend_t *be;     /* requests once started */
     xcb_screen_t *scr;
     xcb_key_symbols_t *key_syms;
     xcb_cursor_t cursor[NUM_CURSOR];
@@ -213,43 +492,94 @@ struct nilwm_t {
     struct atom_t atom;
     struct workspace_t *ws;
     unsigned int ws_idx;    /* current index of workspace */
+    struct client_t *mru;   /* most recently focused first, all workspaces */
 };
 
 /* client.c */
-void init_client(struct client_t *self);
+struct client_t *alloc_client(xcb_window_t win);
+void free_client(struct client_t *self);
+int init_client(struct client_t *self, struct client_query_t *q);
 void config_client(struct client_t *self);
 int check_client_size(struct client_t *self);
 void update_client_geom(struct client_t *self);
 void attach_client(struct client_t *self, struct workspace_t *ws);
 void detach_client(struct client_t *self);
 struct client_t *find_client(xcb_window_t win, struct workspace_t **ws);
+void cleanup_clients();
 void focus_client(struct client_t *self);
 void blur_client(struct client_t *self);
 void raise_client(struct client_t *self);
+void move_client(struct client_t *self, struct client_t *before);
+void touch_client(struct client_t *self);
 void swap_client(struct client_t *self, struct client_t *c);
 void hide_client(struct client_t *self);
 void show_client(struct client_t *self);
+void reparent_client(struct client_t *self, struct workspace_t *ws);
+void mark_title(struct client_t *self);
+int poll_titles();
 
 /* layout.c */
 const struct layout_t *get_layout(struct workspace_t *self);
+void set_focus(struct workspace_t *self, struct client_t *c);
 void arrange_ws(struct workspace_t *self);
+void mark_ws(struct workspace_t *self);
+void settle_ws();
 void hide_ws(struct workspace_t *self);
 void show_ws(struct workspace_t *self);
+void restore_focus(struct workspace_t *self);
+void select_client(struct workspace_t *self, struct client_t *c);
+void cycle_ws(struct workspace_t *self);
+void end_cycle(struct workspace_t *self);
 
 /* bar.c */
 void config_bar();
 void text_bar(int x, int y, const char *str);
 int click_bar(int x);
+void expose_bar(int x, int w);
 void update_bar_ws(unsigned int idx);
 void update_bar_sym();
 void update_bar_status();
+void set_bar_status(const char *s, unsigned int len);
+void update_bar_task(struct client_t *c);
+void open_bar_status();
+int poll_bar_status();
+void draw_bar();
+void cleanup_bar();
+
+/* status.c */
+int start_modules();
+void stop_modules();
+int status_clock(struct module_state_t *self, char *s, int len);
+int status_cpu(struct module_state_t *self, char *s, int len);
+int status_mem(struct module_state_t *self, char *s, int len);
+int status_battery(struct module_state_t *self, char *s, int len);
+int status_net(struct module_state_t *self, char *s, int len);
 
 /* event.c */
+int init_loop();
+void cleanup_loop();
+int add_watch(struct watch_t *w);
+void del_watch(struct watch_t *w);
+int add_timer(struct watch_t *w);
+void set_timer(struct watch_t *w, unsigned int value, unsigned int interval);
+void stop_events();
 void recv_events();
 
+/* stats.c */
+unsigned long now_us();
+void record_event(unsigned int type, unsigned long us);
+void count_requests();
+void start_stats();
+void dump_stats(FILE *f);
+void write_stats();
+void start_phases(int enable);
+void end_phase(const char *name);
+
 /* nilwm.c */
 void spawn(const struct arg_t *arg);
 void focus(const struct arg_t *arg);
+void focus_last(const struct arg_t *arg);
+void cycle(const struct arg_t *arg);
 void swap(const struct arg_t *arg);
 void kill_focused(const struct arg_t *arg);
 void toggle_floating(const struct arg_t *arg);
@@ -259,15 +589,33 @@ void change_ws(const struct arg_t *arg);
 void push(const struct arg_t *arg);
 void quit(const struct arg_t *arg);
 
-int get_text_prop(xcb_window_t win, xcb_atom_t atom, char *s, unsigned int len);
+int reserve_text(struct text_t *t, unsigned int len);
 int cal_text_width(const char *text, int len);
 int check_key(unsigned int mod, xcb_keysym_t key);
 xcb_keysym_t get_keysym(xcb_keycode_t keycode, uint16_t state);
 xcb_keycode_t get_keycode(xcb_keysym_t keysym);
 
+/* backend.c */
+extern const struct backend_t backend_xcb_;
+
+/* record.c */
+int start_record(const char *path);
+void stop_record();
+
+/* mock.c, only linked into tools which run without a server */
+extern const struct backend_t backend_mock_;
+void mock_add_window(xcb_window_t win, const struct window_info_t *info);
+void mock_push_event(const void *e);
+void mock_set_keysym(xcb_keycode_t code, int col, xcb_keysym_t sym);
+void mock_reset();
+void mock_clear_requests();
+unsigned int mock_num_requests();
+const struct mock_request_t *mock_requests();
+
 /* global variables in nilwm.c */
 extern struct nilwm_t nil_;
 extern struct bar_t bar_;
+extern struct stats_t stats_;
 extern const struct config_t cfg_;
 
 #ifdef __cplusplus
@@ -0,0 +1,247 @@
+/*
+ * Nilwm - Lightweight X window manager.
+ * See LICENSE file for copyright and license details.
+ */
+
+#include <stdlib.h>
+#include <string.h>
+#include "nilwm.h"
+
+#define BUFFER_SIZE_        (64 * 1024)
+
+static FILE *rec_;
+static struct backend_t backend_record_;
+
+static
+void put(const void *p, size_t len) {
+    if (fwrite(p, len, 1, rec_) != 1) {
+        NIL_ERR("write record %lu", (unsigned long)len);
+    }
+}
+
+static
+void put_tag(uint8_t tag) {
+    put(&tag, sizeof(tag));
+}
+
+static
+void put_event(xcb_generic_event_t *e) {
+    if (e) {
+        put_tag(REC_EVENT);
+        put(e, NIL_EVENT_SIZE);
+    }
+}
+
+static
+xcb_generic_event_t *poll_event() {
+    xcb_generic_event_t *e;
+
+    e = (*backend_xcb_.poll_event)();
+    put_event(e);
+    return e;
+}
+
+static
+xcb_generic_event_t *poll_queued_event() {
+    xcb_generic_event_t *e;
+
+    e = (*backend_xcb_.poll_queued_event)();
+    put_event(e);
+    return e;
+}
+
+/** Flushes end loop iterations, replay keeps the same batches
+ */
+static
+int flush() {
+    put_tag(REC_FLUSH);
+    return (*backend_xcb_.flush)();
+}
+
+static
+int read_window(struct client_query_t *q, struct window_info_t *info) {
+    struct rec_window_t r;
+    int ret;
+
+    ret = (*backend_xcb_.read_window)(q, info);
+    memset(&r, 0, sizeof(r));
+    r.win = q->win;
+    r.ret = ret;
+    r.override_redirect = info->override_redirect;
+    r.map_state = info->map_state;
+    r.has_geom = info->has_geom;
+    r.wm_delete = info->wm_delete;
+    r.net_name = info->net_name;
+    r.geom = info->geom;
+    r.min_w = info->min_w;
+    r.min_h = info->min_h;
+    r.max_w = info->max_w;
+    r.max_h = info->max_h;
+    r.title_len = info->title ? strlen(info->title) : 0;
+    put_tag(REC_WINDOW);
+    put(&r, sizeof(r));
+    if (r.title_len) {
+        put(info->title, r.title_len);
+    }
+    return ret;
+}
+
+/** Replies that have not arrived are recorded too, replay polls the same
+ */
+static
+int poll_text_property(unsigned int seq, struct text_t *t) {
+    int32_t ret;
+    uint32_t len;
+
+    ret = (*backend_xcb_.poll_text_property)(seq, t);
+    put_tag(REC_TEXT_PROP);
+    put(&ret, sizeof(ret));
+    if (ret > 0) {
+        len = t->len;
+        put(&len, sizeof(len));
+        put(t->s, len);
+    }
+    return ret;
+}
+
+static
+xcb_keysym_t lookup_keysym(xcb_keycode_t code, int col) {
+    xcb_keysym_t sym;
+
+    sym = (*backend_xcb_.lookup_keysym)(code, col);
+    put_tag(REC_KEYSYM);
+    put(&sym, sizeof(sym));
+    return sym;
+}
+
+/** Write what the wm manages now
+ */
+static
+void put_state() {
+    struct rec_header_t h;
+    struct rec_ws_t rw;
+    struct rec_client_t rc;
+    struct workspace_t *ws;
+    struct client_t *c;
+    unsigned int i;
+    uint32_t n;
+
+    memset(&h, 0, sizeof(h));
+    h.magic = RECORD_MAGIC;
+    h.version = RECORD_VERSION;
+    h.num_workspaces = cfg_.num_workspaces;
+    for (i = 0; i < cfg_.num_workspaces; ++i) {
+        for (c = nil_.ws[i].first; c; c = c->next) {
+            ++h.num_clients;
+        }
+    }
+    h.ws_idx = nil_.ws_idx;
+    h.root = nil_.scr->root;
+    h.scr_w = nil_.scr->width_in_pixels;
+    h.scr_h = nil_.scr->height_in_pixels;
+    h.x = nil_.x;
+    h.y = nil_.y;
+    h.w = nil_.w;
+    h.h = nil_.h;
+    h.bar_win = bar_.win;
+    h.bar_pixmap = bar_.pixmap;
+    h.bar_x = bar_.x;
+    h.bar_y = bar_.y;
+    h.bar_w = bar_.w;
+    h.bar_h = bar_.h;
+    h.font = nil_.font;
+    h.atom = nil_.atom;
+    h.mask_numlock = nil_.mask_numlock;
+    h.mask_capslock = nil_.mask_capslock;
+    h.mask_shiftlock = nil_.mask_shiftlock;
+    h.mask_modeswitch = nil_.mask_modeswitch;
+    put(&h, sizeof(h));
+    for (i = 0; i < cfg_.num_workspaces; ++i) {
+        ws = &nil_.ws[i];
+        memset(&rw, 0, sizeof(rw));
+        rw.layout = ws->layout;
+        rw.master_size = ws->master_size;
+        rw.focus = ws->focus ? ws->focus->win : XCB_NONE;
+        rw.win = ws->win;
+        rw.flags = ws->flags;
+        rw.cycle = ws->cycle ? ws->cycle->win : XCB_NONE;
+        put(&rw, sizeof(rw));
+    }
+    /* clients in list order */
+    for (i = 0; i < cfg_.num_workspaces; ++i) {
+        for (c = nil_.ws[i].first; c; c = c->next) {
+            memset(&rc, 0, sizeof(rc));
+            rc.win = c->win;
+            rc.ws = i;
+            rc.flags = c->flags;
+            rc.x = c->x;
+            rc.y = c->y;
+            rc.w = c->w;
+            rc.h = c->h;
+            rc.geom = c->geom;
+            rc.min_w = c->min_w;
+            rc.min_h = c->min_h;
+            rc.max_w = c->max_w;
+            rc.max_h = c->max_h;
+            rc.border_width = c->border_width;
+            rc.title_len = c->title.len;
+            put(&rc, sizeof(rc));
+            if (rc.title_len) {
+                put(c->title.s, rc.title_len);
+            }
+        }
+    }
+    /* focus histories */
+    for (i = 0; i < cfg_.num_workspaces; ++i) {
+        n = 0;
+        for (c = nil_.ws[i].mru; c; c = c->mru_next) {
+            ++n;
+        }
+        put(&n, sizeof(n));
+        for (c = nil_.ws[i].mru; c; c = c->mru_next) {
+            put(&c->win, sizeof(c->win));
+        }
+    }
+    n = 0;
+    for (c = nil_.mru; c; c = c->gmru_next) {
+        ++n;
+    }
+    put(&n, sizeof(n));
+    for (c = nil_.mru; c; c = c->gmru_next) {
+        put(&c->win, sizeof(c->win));
+    }
+}
+
+/** Record every event and reply from now on
+ * Requests are not recorded, replaying the session produces them again.
+ */
+int start_record(const char *path) {
+    rec_ = fopen(path, "wb");
+    if (!rec_) {
+        NIL_ERR("open record %s", path);
+        return -1;
+    }
+    setvbuf(rec_, 0, _IOFBF, BUFFER_SIZE_);
+    put_state();
+    backend_record_ = backend_xcb_;
+    backend_record_.name = "record";
+    backend_record_.poll_event = &poll_event;
+    backend_record_.poll_queued_event = &poll_queued_event;
+    backend_record_.flush = &flush;
+    backend_record_.read_window = &read_window;
+    backend_record_.poll_text_property = &poll_text_property;
+    backend_record_.lookup_keysym = &lookup_keysym;
+    nil_.be = &backend_record_;
+    return 0;
+}
+
+void stop_record() {
+    if (!rec_) {
+        return;
+    }
+    nil_.be = &backend_xcb_;
+    fclose(rec_);
+    rec_ = 0;
+}
+
+/* vim: set ts=4 sw=4 expandtab: */
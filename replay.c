@@ -0,0 +1,464 @@
+/*
+ * Nilwm - Lightweight X window manager.
+ * See LICENSE file for copyright and license details.
+ */
+
+/* Replay a session recorded with nilwm -r, without any X server.
+ * The state is restored from the trace, then the real events loop runs on the
+ * recorded events and replies while requests go to the mock backend. Each
+ * flush writes its requests to the requests file as "batch opcode win mask"
+ * so that two builds can be diffed, and handler latencies are printed at the
+ * end. Drag and status updates are rate limited on wall time and may batch
+ * differently.
+ */
+
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include "nilwm.h"
+
+static FILE *in_;
+static FILE *out_;
+static int tag_ = EOF;              /* tag of the next record */
+static int pipe_[2] = { -1, -1 };
+static unsigned long batch_;
+static struct backend_t backend_replay_;
+static xcb_screen_t screen_;
+
+static
+int get(void *p, size_t len) {
+    if (len == 0 || fread(p, len, 1, in_) == 1) {
+        return 0;
+    }
+    NIL_ERR("truncated trace %lu", (unsigned long)len);
+    tag_ = EOF;
+    return -1;
+}
+
+static
+void next_tag() {
+    tag_ = getc(in_);
+}
+
+/** Skip the payload of the next record
+ */
+static
+void skip() {
+    struct rec_window_t r;
+    char buf[NIL_EVENT_SIZE];
+    int32_t n;
+    uint32_t len;
+    int ret;
+
+    switch (tag_) {
+    case REC_EVENT:
+        ret = get(buf, NIL_EVENT_SIZE);
+        break;
+    case REC_FLUSH:
+        ret = 0;
+        break;
+    case REC_WINDOW:
+        ret = get(&r, sizeof(r));
+        if (ret == 0) {
+            ret = fseek(in_, r.title_len, SEEK_CUR);
+        }
+        break;
+    case REC_KEYSYM:
+        ret = get(&n, sizeof(n));
+        break;
+    case REC_TEXT_PROP:
+        ret = get(&n, sizeof(n));
+        if (ret == 0 && n > 0) {
+            ret = get(&len, sizeof(len));
+        }
+        if (ret == 0 && n > 0) {
+            ret = fseek(in_, len, SEEK_CUR);
+        }
+        break;
+    default:
+        NIL_ERR("bad record %d", tag_);
+        ret = -1;
+        break;
+    }
+    if (ret != 0) {
+        tag_ = EOF;
+        return;
+    }
+    next_tag();
+}
+
+/** Move to the next reply of a type
+ * Replies the replay did not ask for are skipped, up to the end of the batch.
+ * The caller reads the payload, then calls next_tag.
+ * @return 0 if there is none
+ */
+static
+int take_reply(int tag) {
+    while (tag_ != EOF && tag_ != tag && tag_ != REC_EVENT
+        && tag_ != REC_FLUSH) {
+        skip();
+    }
+    return tag_ == tag;
+}
+
+/** Always readable, batches are delimited by the flush records
+ */
+static
+int get_fd() {
+    return pipe_[0];
+}
+
+/** Next event of the batch
+ * Replies after the events were read at the end of the iteration, they are
+ * left to it.
+ */
+static
+xcb_generic_event_t *poll_event() {
+    xcb_generic_event_t *e;
+
+    if (tag_ == EOF) {
+        stop_events();
+        return 0;
+    }
+    if (tag_ != REC_EVENT) {
+        return 0;
+    }
+    e = calloc(1, sizeof(xcb_generic_event_t));
+    if (!e || get(e, NIL_EVENT_SIZE) != 0) {
+        free(e);
+        tag_ = EOF;
+        stop_events();
+        return 0;
+    }
+    next_tag();
+    return e;
+}
+
+/** End of a batch, write the requests it produced
+ */
+static
+int flush() {
+    const struct mock_request_t *r;
+    unsigned int i, n;
+
+    if (take_reply(REC_FLUSH)) {
+        next_tag();
+    }
+    r = mock_requests();
+    n = mock_num_requests();
+    for (i = 0; out_ && i < n; ++i) {
+        if (r[i].type != XCB_NO_OPERATION) {
+            fprintf(out_, "%lu %u 0x%x 0x%x\n", batch_, r[i].type, r[i].win,
+                r[i].mask);
+        }
+    }
+    mock_clear_requests();
+    ++batch_;
+    return 1;
+}
+
+static
+int read_window(struct client_query_t *q, struct window_info_t *info) {
+    struct rec_window_t r;
+
+    memset(info, 0, sizeof(struct window_info_t));
+    if (!take_reply(REC_WINDOW) || get(&r, sizeof(r)) != 0) {
+        return -1;
+    }
+    if (r.title_len) {
+        info->title = malloc(r.title_len + 1);
+        if (!info->title || get(info->title, r.title_len) != 0) {
+            free(info->title);
+            info->title = 0;
+            tag_ = EOF;
+            return -1;
+        }
+        info->title[r.title_len] = '\0';
+    }
+    next_tag();
+    if (r.win != q->win) {
+        NIL_ERR("replay window 0x%x recorded 0x%x", q->win, r.win);
+        free(info->title);
+        info->title = 0;
+        return -1;
+    }
+    info->override_redirect = r.override_redirect;
+    info->map_state = r.map_state;
+    info->has_geom = r.has_geom;
+    info->wm_delete = r.wm_delete;
+    info->net_name = r.net_name;
+    info->geom = r.geom;
+    info->min_w = r.min_w;
+    info->min_h = r.min_h;
+    info->max_w = r.max_w;
+    info->max_h = r.max_h;
+    return r.ret;
+}
+
+static
+int poll_text_property(unsigned int NIL_UNUSED(seq), struct text_t *t) {
+    int32_t n;
+    uint32_t len;
+
+    if (!take_reply(REC_TEXT_PROP) || get(&n, sizeof(n)) != 0) {
+        return -1;
+    }
+    if (n <= 0) {
+        next_tag();
+        return n;
+    }
+    if (get(&len, sizeof(len)) != 0) {
+        return -1;
+    }
+    if (reserve_text(t, len) != 0) {
+        tag_ = EOF;
+        return -1;
+    }
+    if (get(t->s, len) != 0) {
+        return -1;
+    }
+    t->s[len] = '\0';
+    t->len = len;
+    next_tag();
+    return 1;
+}
+
+static
+xcb_keysym_t lookup_keysym(xcb_keycode_t NIL_UNUSED(code),
+    int NIL_UNUSED(col)) {
+    xcb_keysym_t sym;
+
+    if (!take_reply(REC_KEYSYM) || get(&sym, sizeof(sym)) != 0) {
+        return XCB_NO_SYMBOL;
+    }
+    next_tag();
+    return sym;
+}
+
+/** Link the clients of a recorded focus history, the global one if no ws
+ */
+static
+int load_history(struct workspace_t *ws) {
+    struct client_t *c, **tail;
+    xcb_window_t win;
+    uint32_t n;
+
+    if (get(&n, sizeof(n)) != 0) {
+        return -1;
+    }
+    tail = ws ? &ws->mru : &nil_.mru;
+    for (; n > 0; --n) {
+        if (get(&win, sizeof(win)) != 0) {
+            return -1;
+        }
+        c = find_client(win, 0);
+        if (!c || (ws && (c->ws != ws || c->mru_prev))
+            || (!ws && c->gmru_prev)) {
+            NIL_ERR("bad history %d", win);
+            return -1;
+        }
+        if (ws) {
+            c->mru_prev = tail;
+            *tail = c;
+            tail = &c->mru_next;
+        } else {
+            c->gmru_prev = tail;
+            *tail = c;
+            tail = &c->gmru_next;
+        }
+    }
+    return 0;
+}
+
+/** Restore what the wm managed when recording started
+ */
+static
+int load_state() {
+    struct rec_header_t h;
+    struct rec_ws_t *rw;
+    struct rec_client_t rc;
+    struct client_t **cs, *c;
+    unsigned int i;
+    int ret;
+
+    if (get(&h, sizeof(h)) != 0) {
+        return -1;
+    }
+    if (h.magic != RECORD_MAGIC || h.version != RECORD_VERSION) {
+        NIL_ERR("not a trace, version %u", h.version);
+        return -1;
+    }
+    if (h.num_workspaces != cfg_.num_workspaces
+        || h.ws_idx >= cfg_.num_workspaces) {
+        NIL_ERR("recorded %u workspaces", h.num_workspaces);
+        return -1;
+    }
+    screen_.root = h.root;
+    screen_.width_in_pixels = h.scr_w;
+    screen_.height_in_pixels = h.scr_h;
+    nil_.scr = &screen_;
+    nil_.x = h.x;
+    nil_.y = h.y;
+    nil_.w = h.w;
+    nil_.h = h.h;
+    nil_.ws_idx = h.ws_idx;
+    nil_.mask_numlock = h.mask_numlock;
+    nil_.mask_capslock = h.mask_capslock;
+    nil_.mask_shiftlock = h.mask_shiftlock;
+    nil_.mask_modeswitch = h.mask_modeswitch;
+    bar_.win = h.bar_win;
+    bar_.pixmap = h.bar_pixmap;
+    bar_.x = h.bar_x;
+    bar_.y = h.bar_y;
+    bar_.w = h.bar_w;
+    bar_.h = h.bar_h;
+    nil_.font = h.font;
+    nil_.atom = h.atom;
+    config_bar();
+
+    nil_.ws = calloc(cfg_.num_workspaces, sizeof(struct workspace_t));
+    rw = malloc(cfg_.num_workspaces * sizeof(struct rec_ws_t));
+    cs = calloc(h.num_clients + 1, sizeof(struct client_t *));
+    ret = -1;
+    if (!nil_.ws || !rw || !cs
+        || get(rw, cfg_.num_workspaces * sizeof(struct rec_ws_t)) != 0) {
+        goto end;
+    }
+    for (i = 0; i < cfg_.num_workspaces; ++i) {
+        nil_.ws[i].layout = rw[i].layout % NUM_LAYOUT;
+        nil_.ws[i].master_size = rw[i].master_size;
+        nil_.ws[i].win = rw[i].win;
+        nil_.ws[i].flags = rw[i].flags;
+    }
+    for (i = 0; i < h.num_clients; ++i) {
+        if (get(&rc, sizeof(rc)) != 0 || rc.ws >= cfg_.num_workspaces) {
+            goto end;
+        }
+        c = alloc_client(rc.win);
+        if (!c) {
+            goto end;
+        }
+        cs[i] = c;
+        c->ws = &nil_.ws[rc.ws];    /* attached below */
+        c->flags = rc.flags & ~CLIENT_TITLE;
+        if (NIL_HAS_FLAG(rc.flags, CLIENT_TITLE)) {
+            mark_title(c);
+        }
+        c->x = rc.x;
+        c->y = rc.y;
+        c->w = rc.w;
+        c->h = rc.h;
+        c->geom = rc.geom;
+        c->min_w = rc.min_w;
+        c->min_h = rc.min_h;
+        c->max_w = rc.max_w;
+        c->max_h = rc.max_h;
+        c->border_width = rc.border_width;
+        if (rc.title_len) {
+            if (reserve_text(&c->title, rc.title_len) != 0
+                || get(c->title.s, rc.title_len) != 0) {
+                goto end;
+            }
+            c->title.s[rc.title_len] = '\0';
+            c->title.len = rc.title_len;
+        }
+    }
+    /* clients are attached at the head, keep the recorded order */
+    while (i-- > 0) {
+        attach_client(cs[i], cs[i]->ws);
+        cs[i] = 0;
+    }
+    for (i = 0; i < cfg_.num_workspaces; ++i) {
+        if (rw[i].focus != XCB_NONE) {
+            nil_.ws[i].focus = find_client(rw[i].focus, 0);
+        }
+        if (rw[i].cycle != XCB_NONE) {
+            nil_.ws[i].cycle = find_client(rw[i].cycle, 0);
+        }
+    }
+    for (i = 0; i <= cfg_.num_workspaces; ++i) {
+        if (load_history((i < cfg_.num_workspaces) ? &nil_.ws[i] : 0) != 0) {
+            goto end;
+        }
+    }
+    ret = 0;
+end:
+    for (i = 0; cs && ret != 0 && i < h.num_clients; ++i) {
+        if (cs[i]) {
+            free_client(cs[i]);
+        }
+    }
+    free(cs);
+    free(rw);
+    return ret;
+}
+
+int main(int argc, char **argv) {
+    unsigned long start;
+    int ret;
+
+    if (argc < 2 || argc > 3) {
+        fprintf(stderr, "usage: %s trace [requests]\n", argv[0]);
+        return 1;
+    }
+    in_ = fopen(argv[1], "rb");
+    if (!in_) {
+        NIL_ERR("open %s", argv[1]);
+        return 1;
+    }
+    if (argc > 2) {
+        out_ = fopen(argv[2], "w");
+        if (!out_) {
+            NIL_ERR("open %s", argv[2]);
+            fclose(in_);
+            return 1;
+        }
+    }
+    backend_replay_ = backend_mock_;
+    backend_replay_.name = "replay";
+    backend_replay_.get_fd = &get_fd;
+    backend_replay_.flush = &flush;
+    backend_replay_.poll_event = &poll_event;
+    backend_replay_.poll_queued_event = &poll_event;
+    backend_replay_.read_window = &read_window;
+    backend_replay_.poll_text_property = &poll_text_property;
+    backend_replay_.lookup_keysym = &lookup_keysym;
+    nil_.be = &backend_replay_;
+
+    ret = 1;
+    if (load_state() != 0) {
+        goto end;
+    }
+    if (pipe(pipe_) != 0 || write(pipe_[1], "", 1) != 1) {
+        NIL_ERR("pipe %d", pipe_[0]);
+        goto end;
+    }
+    next_tag();
+    if (init_loop() != 0) {
+        goto end;
+    }
+    start = now_us();
+    recv_events();
+    printf("# replayed %lu batches in %lu us\n", batch_, now_us() - start);
+    dump_stats(stdout);
+    ret = 0;
+end:
+    cleanup_bar();
+    cleanup_loop();
+    if (pipe_[0] >= 0) {
+        close(pipe_[0]);
+        close(pipe_[1]);
+    }
+    if (nil_.ws) {
+        cleanup_clients();
+        free(nil_.ws);
+    }
+    mock_reset();
+    if (out_) {
+        fclose(out_);
+    }
+    fclose(in_);
+    return ret;
+}
+
+/* vim: set ts=4 sw=4 expandtab: */
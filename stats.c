@@ -0,0 +1,175 @@
+/*
+ * Nilwm - Lightweight X window manager.
+ * See LICENSE file for copyright and license details.
+ */
+
+#include <string.h>
+#include <time.h>
+#include "nilwm.h"
+
+struct stats_t stats_;
+static unsigned int last_seq_;      /* sequence of the last NoOperation */
+static int phases_;                 /* startup report enabled */
+static unsigned long phase_start_;  /* when the first phase began (us) */
+static unsigned long phase_time_;   /* when the current phase began (us) */
+static unsigned long phase_trips_;
+static unsigned long phase_reqs_;
+
+static const char *EVENT_NAMES_[] = {
+    [XCB_KEY_PRESS]         = "key_press",
+    [XCB_KEY_RELEASE]       = "key_release",
+    [XCB_BUTTON_PRESS]      = "button_press",
+    [XCB_BUTTON_RELEASE]    = "button_release",
+    [XCB_MOTION_NOTIFY]     = "motion_notify",
+    [XCB_ENTER_NOTIFY]      = "enter_notify",
+    [XCB_LEAVE_NOTIFY]      = "leave_notify",
+    [XCB_FOCUS_IN]          = "focus_in",
+    [XCB_FOCUS_OUT]         = "focus_out",
+    [XCB_EXPOSE]            = "expose",
+    [XCB_CREATE_NOTIFY]     = "create_notify",
+    [XCB_DESTROY_NOTIFY]    = "destroy_notify",
+    [XCB_UNMAP_NOTIFY]      = "unmap_notify",
+    [XCB_MAP_NOTIFY]        = "map_notify",
+    [XCB_MAP_REQUEST]       = "map_request",
+    [XCB_REPARENT_NOTIFY]   = "reparent_notify",
+    [XCB_CONFIGURE_NOTIFY]  = "configure_notify",
+    [XCB_CONFIGURE_REQUEST] = "configure_request",
+    [XCB_PROPERTY_NOTIFY]   = "property_notify",
+    [XCB_CLIENT_MESSAGE]    = "client_message",
+    [XCB_MAPPING_NOTIFY]    = "mapping_notify",
+};
+
+/** Monotonic clock in microseconds
+ */
+unsigned long now_us() {
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (unsigned long)ts.tv_sec * 1000000 + ts.tv_nsec / 1000;
+}
+
+/** Add a handler duration to the histogram of an event type
+ */
+void record_event(unsigned int type, unsigned long us) {
+    struct hist_t *h;
+    unsigned int i;
+
+    if (type >= NUM_EVENT_TYPE) {
+        return;
+    }
+    h = &stats_.event[type];
+    ++h->count;
+    h->total += us;
+    if (us > h->max) {
+        h->max = us;
+    }
+    /* bucket i holds durations below 2^i us */
+    for (i = 0; (i < NUM_HIST - 1) && (us >> i); ++i) {
+    }
+    ++h->bucket[i];
+}
+
+/** Count requests issued since the last call
+ * No counter is kept per request: the sequence number of a NoOperation tells
+ * how many requests were sent before it. It is sampled only when the count
+ * is reported, the loop sends nothing for it.
+ */
+void count_requests() {
+    unsigned int seq;
+
+    seq = (*nil_.be->no_operation)();
+    stats_.requests += seq - last_seq_ - 1;
+    last_seq_ = seq;
+}
+
+/** Count from the loop on, startup has its own report, see end_phase
+ * The phase marks move along so that the startup report stays right.
+ */
+void start_stats() {
+    count_requests();
+    phase_trips_ -= stats_.round_trips;
+    phase_reqs_ -= stats_.requests;
+    stats_.round_trips = 0;
+    stats_.requests = 0;
+}
+
+void dump_stats(FILE *f) {
+    const struct hist_t *h;
+    unsigned int i, j;
+
+    count_requests();
+    fprintf(f, "wakeups %lu\nevents %lu\nmax_batch %u\nflushes %lu\n"
+        "requests %lu\nround_trips %lu\nreplies %lu\n", stats_.wakeups,
+        stats_.events, stats_.max_batch, stats_.flushes, stats_.requests,
+        stats_.round_trips, stats_.replies);
+    fprintf(f, "%-18s %8s %8s %8s  histogram (<1us <2us <4us ...)\n", "event",
+        "count", "avg_us", "max_us");
+    for (i = 0; i < NUM_EVENT_TYPE; ++i) {
+        h = &stats_.event[i];
+        if (h->count == 0) {
+            continue;
+        }
+        if (i < NIL_LEN(EVENT_NAMES_) && EVENT_NAMES_[i]) {
+            fprintf(f, "%-18s", EVENT_NAMES_[i]);
+        } else {
+            fprintf(f, "event_%-12u", i);
+        }
+        fprintf(f, " %8lu %8lu %8lu ", h->count, h->total / h->count, h->max);
+        for (j = 0; j < NUM_HIST; ++j) {
+            fprintf(f, " %lu", h->bucket[j]);
+        }
+        fprintf(f, "\n");
+    }
+    fflush(f);
+}
+
+/** Begin the startup report, nothing is reported unless enabled
+ */
+void start_phases(int enable) {
+    phases_ = enable;
+    phase_start_ = phase_time_ = now_us();
+}
+
+/** Report wall time, round trips and requests since the previous phase
+ * The report ends with the first managed window.
+ */
+void end_phase(const char *name) {
+    unsigned long now;
+
+    if (!phases_) {
+        return;
+    }
+    now = now_us();
+    if (nil_.con) {
+        count_requests();
+    }
+    fprintf(stderr, "startup %-12s %8lu us %8lu us total %4lu round trips "
+        "%5lu requests\n", name, now - phase_time_, now - phase_start_,
+        stats_.round_trips - phase_trips_, stats_.requests - phase_reqs_);
+    phase_time_ = now;
+    phase_trips_ = stats_.round_trips;
+    phase_reqs_ = stats_.requests;
+    if (strcmp(name, PHASE_FIRST_WINDOW) == 0) {
+        phases_ = 0;
+    }
+}
+
+/** Dump stats into the configured stats file or stderr
+ */
+void write_stats() {
+    FILE *f;
+
+    if (!cfg_.stats_file) {
+        dump_stats(stderr);
+        return;
+    }
+    f = fopen(cfg_.stats_file, "w");
+    if (!f) {
+        NIL_ERR("open stats file %s", cfg_.stats_file);
+        return;
+    }
+    dump_stats(f);
+    fclose(f);
+}
+
+/* vim: set ts=4 sw=4 expandtab: */
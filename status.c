@@ -0,0 +1,309 @@
+/*
+ * Nilwm - Lightweight X window manager.
+ * See LICENSE file for copyright and license details.
+ */
+
+/* Built-in status modules, configured by MODULES in config.h.
+ * Each module has its own timer. Files are opened once and read again with
+ * pread, texts are formatted in fixed buffers, so a refresh allocates nothing.
+ * The status is rebuilt only when the text of a module changes.
+ */
+
+#include <errno.h>
+#include <fcntl.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include "nilwm.h"
+
+#define MODULE_LEN_         64      /* text of a module */
+#define READ_SIZE_          512     /* enough for the fields used */
+#define PATH_LEN_           128
+#define SEPARATOR_          " | "
+
+/* state of a configured module */
+struct module_state_t {
+    const struct module_t *conf;
+    struct watch_t timer;
+    int fd[2];                      /* kept open, read again with pread */
+    unsigned long long last[2];     /* counters of the previous refresh */
+    unsigned long time;             /* of the previous refresh (us) */
+    char text[MODULE_LEN_];
+    int len;
+};
+
+static struct module_state_t *modules_;
+static unsigned int modules_len_;
+static struct text_t line_;         /* all module texts */
+
+/** Open a file the first time, later refreshes only read it again
+ * The path is a format with the module argument.
+ */
+static
+int open_file(struct module_state_t *self, int i, const char *path) {
+    char buf[PATH_LEN_];
+
+    if (self->fd[i] >= 0) {
+        return self->fd[i];
+    }
+    snprintf(buf, sizeof(buf), path, self->conf->arg);
+    self->fd[i] = open(buf, O_RDONLY | O_CLOEXEC);
+    return self->fd[i];
+}
+
+/** Read the beginning of a file, null terminated
+ */
+static
+int read_file(int fd, char *buf, int size) {
+    ssize_t n;
+
+    if (fd < 0) {
+        return -1;
+    }
+    n = pread(fd, buf, size - 1, 0);
+    if (n < 0) {
+        NIL_ERR("pread %d %d", fd, errno);
+        return -1;
+    }
+    buf[n] = '\0';
+    return (int)n;
+}
+
+static
+unsigned long long read_number(struct module_state_t *self, int i,
+    const char *path) {
+    char buf[32];
+
+    if (read_file(open_file(self, i, path), buf, sizeof(buf)) < 0) {
+        return 0;
+    }
+    return strtoull(buf, 0, 10);
+}
+
+/** Number after a key in a "key: number" file
+ */
+static
+unsigned long long get_field(const char *buf, const char *key) {
+    const char *p;
+
+    p = strstr(buf, key);
+    return p ? strtoull(p + strlen(key), 0, 10) : 0;
+}
+
+/** Local time, formatted by the argument
+ */
+int status_clock(struct module_state_t *self, char *s, int len) {
+    struct tm tm;
+    time_t t;
+
+    t = time(0);
+    if (!localtime_r(&t, &tm)) {
+        return -1;
+    }
+    len = strftime(s, len, self->conf->arg ? self->conf->arg : "%H:%M", &tm);
+    return (len > 0) ? len : -1;
+}
+
+/** Busy time of all CPUs since the previous refresh
+ */
+int status_cpu(struct module_state_t *self, char *s, int len) {
+    char buf[READ_SIZE_];
+    char *p;
+    unsigned long long v, total, idle, dt;
+    int i;
+
+    if ((read_file(open_file(self, 0, "/proc/stat"), buf, sizeof(buf)) < 0)
+        || strncmp(buf, "cpu ", 4) != 0) {
+        return -1;
+    }
+    /* user nice system idle iowait irq softirq steal */
+    p = buf + 4;
+    total = idle = 0;
+    for (i = 0; i < 8; ++i) {
+        v = strtoull(p, &p, 10);
+        total += v;
+        if ((i == 3) || (i == 4)) {
+            idle += v;
+        }
+    }
+    dt = total - self->last[0];
+    v = dt ? 100 * (dt - (idle - self->last[1])) / dt : 0;
+    self->last[0] = total;
+    self->last[1] = idle;
+    return snprintf(s, len, "cpu %llu%%", v);
+}
+
+/** Memory not available for new programs
+ */
+int status_mem(struct module_state_t *self, char *s, int len) {
+    char buf[READ_SIZE_];
+    unsigned long long total, avail;
+
+    if (read_file(open_file(self, 0, "/proc/meminfo"), buf, sizeof(buf)) < 0) {
+        return -1;
+    }
+    total = get_field(buf, "MemTotal:");
+    avail = get_field(buf, "MemAvailable:");
+    if ((total == 0) || (avail > total)) {
+        return -1;
+    }
+    return snprintf(s, len, "mem %llu%%", 100 * (total - avail) / total);
+}
+
+/** Charge of the power supply named by the argument, + if charging
+ */
+int status_battery(struct module_state_t *self, char *s, int len) {
+    char buf[32];
+    const char *state;
+
+    if (read_file(open_file(self, 0, "/sys/class/power_supply/%s/capacity"),
+        buf, sizeof(buf)) < 0) {
+        return -1;
+    }
+    state = "";
+    if (read_file(open_file(self, 1, "/sys/class/power_supply/%s/status"),
+        buf + 16, sizeof(buf) - 16) > 0) {
+        if (buf[16] == 'C') {
+            state = "+";
+        } else if (buf[16] == 'D') {
+            state = "-";
+        }
+    }
+    return snprintf(s, len, "bat %lu%%%s", strtoul(buf, 0, 10), state);
+}
+
+/** Received and sent KiB/s of the interface named by the argument
+ */
+int status_net(struct module_state_t *self, char *s, int len) {
+    unsigned long long rx, tx, rx_rate, tx_rate;
+    unsigned long now, dt;
+
+    rx = read_number(self, 0, "/sys/class/net/%s/statistics/rx_bytes");
+    tx = read_number(self, 1, "/sys/class/net/%s/statistics/tx_bytes");
+    if (self->fd[0] < 0) {
+        return -1;
+    }
+    now = now_us();
+    dt = now - self->time;
+    rx_rate = tx_rate = 0;
+    if (self->time && dt) {
+        rx_rate = (rx - self->last[0]) * 1000000 / dt / 1024;
+        tx_rate = (tx - self->last[1]) * 1000000 / dt / 1024;
+    }
+    self->last[0] = rx;
+    self->last[1] = tx;
+    self->time = now;
+    return snprintf(s, len, "%s %lluK/%lluK", self->conf->arg, rx_rate,
+        tx_rate);
+}
+
+/** Join the module texts into the bar status
+ */
+static
+void show_modules() {
+    unsigned int i;
+    char *p;
+
+    p = line_.s;
+    for (i = 0; i < modules_len_; ++i) {
+        if (modules_[i].len <= 0) {
+            continue;
+        }
+        if (p != line_.s) {
+            memcpy(p, SEPARATOR_, sizeof(SEPARATOR_) - 1);
+            p += sizeof(SEPARATOR_) - 1;
+        }
+        memcpy(p, modules_[i].text, modules_[i].len);
+        p += modules_[i].len;
+    }
+    line_.len = p - line_.s;
+    *p = '\0';
+    set_bar_status(line_.s, line_.len);
+}
+
+/** Refresh a module
+ * @return 1 if its text changed
+ */
+static
+int refresh_module(struct module_state_t *self) {
+    char text[MODULE_LEN_];
+    int len;
+
+    len = (*self->conf->func)(self, text, sizeof(text));
+    if (len >= (int)sizeof(text)) {     /* truncated by snprintf */
+        len = sizeof(text) - 1;
+    }
+    if (len < 0) {
+        len = 0;
+    }
+    if ((len == self->len) && (memcmp(text, self->text, len) == 0)) {
+        return 0;
+    }
+    memcpy(self->text, text, len);
+    self->len = len;
+    return 1;
+}
+
+static
+void handle_module_timer(struct watch_t *w) {
+    if (refresh_module(w->data)) {
+        show_modules();
+    }
+}
+
+/** Start the configured modules, the bar status is theirs from now on
+ */
+int start_modules() {
+    struct module_state_t *m;
+    unsigned int i;
+
+    if (cfg_.modules_len == 0) {
+        return 0;
+    }
+    modules_ = calloc(cfg_.modules_len, sizeof(struct module_state_t));
+    if (!modules_ || (reserve_text(&line_, cfg_.modules_len
+        * (MODULE_LEN_ + sizeof(SEPARATOR_))) != 0)) {
+        NIL_ERR("out of mem %u", cfg_.modules_len);
+        stop_modules();
+        return -1;
+    }
+    modules_len_ = cfg_.modules_len;
+    for (i = 0; i < modules_len_; ++i) {
+        m = &modules_[i];
+        m->conf = &cfg_.modules[i];
+        m->fd[0] = m->fd[1] = -1;
+        m->timer.fd = -1;
+        m->timer.func = &handle_module_timer;
+        m->timer.data = m;
+        if (add_timer(&m->timer) != 0) {
+            stop_modules();
+            return -1;
+        }
+        refresh_module(m);
+        set_timer(&m->timer, m->conf->interval, m->conf->interval);
+    }
+    show_modules();
+    return 0;
+}
+
+void stop_modules() {
+    unsigned int i;
+
+    for (i = 0; i < modules_len_; ++i) {
+        del_watch(&modules_[i].timer);
+        if (modules_[i].fd[0] >= 0) {
+            close(modules_[i].fd[0]);
+        }
+        if (modules_[i].fd[1] >= 0) {
+            close(modules_[i].fd[1]);
+        }
+    }
+    free(modules_);
+    free(line_.s);
+    modules_ = 0;
+    modules_len_ = 0;
+    memset(&line_, 0, sizeof(line_));
+}
+
+/* vim: set ts=4 sw=4 expandtab: */
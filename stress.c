@@ -0,0 +1,425 @@
+/*
+ * Nilwm - Lightweight X window manager.
+ * See LICENSE file for copyright and license details.
+ */
+
+/* Stress client measuring latencies seen by X clients while nilwm runs.
+ * Keys are injected with XTest, see stress.sh to run it on Xvfb.
+ * One line per result: name, count, avg, p50, p99 and max in us. The wm
+ * CPU time line gives ms per 1000 windows opened and closed.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <poll.h>
+#include <time.h>
+#include <X11/keysym.h>
+#include <xcb/xcb.h>
+#include <xcb/xtest.h>
+#include <xcb/xcb_keysyms.h>
+
+#define TIMEOUT_MS_         5000
+#define IDLE_MS_            200     /* wm is done when no event comes */
+#define CPU_WINDOWS_        1000
+#define MOD_INDEX_          6       /* Mod4 in the modifier mapping */
+
+#define ERR_(fmt, ...)      fprintf(stderr, "stress: " fmt "\n", __VA_ARGS__)
+
+static xcb_connection_t *con_;
+static xcb_screen_t *scr_;
+static xcb_keycode_t key_mod_, key_next_, key_ws1_, key_ws2_;
+static xcb_window_t *wins_;
+static unsigned int num_wins_;
+static unsigned int num_switched_;  /* windows unmapped by a switch */
+
+static
+unsigned long now_us() {
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (unsigned long)ts.tv_sec * 1000000 + ts.tv_nsec / 1000;
+}
+
+/** Wait for the next event
+ * @return 0 if nothing came before the timeout
+ */
+static
+xcb_generic_event_t *wait_event(int timeout) {
+    xcb_generic_event_t *e;
+    struct pollfd pfd;
+
+    pfd.fd = xcb_get_file_descriptor(con_);
+    pfd.events = POLLIN;
+    while (!(e = xcb_poll_for_event(con_))) {
+        if (xcb_connection_has_error(con_)) {
+            ERR_("connection error %d", xcb_connection_has_error(con_));
+            exit(1);
+        }
+        if (poll(&pfd, 1, timeout) <= 0) {
+            return 0;
+        }
+    }
+    return e;
+}
+
+/** Wait until n events of a type arrived
+ */
+static
+int wait_events(uint8_t type, unsigned int n) {
+    xcb_generic_event_t *e;
+
+    while (n > 0) {
+        e = wait_event(TIMEOUT_MS_);
+        if (!e) {
+            ERR_("timeout waiting event %u", type);
+            return -1;
+        }
+        if ((e->response_type & ~0x80) == type) {
+            --n;
+        }
+        free(e);
+    }
+    return 0;
+}
+
+/** Drop events until nothing happens for a while
+ */
+static
+void wait_idle() {
+    xcb_generic_event_t *e;
+
+    while ((e = wait_event(IDLE_MS_))) {
+        free(e);
+    }
+}
+
+static
+void fake_key(xcb_keycode_t key, uint8_t type) {
+    xcb_test_fake_input(con_, type, key, XCB_CURRENT_TIME, XCB_NONE, 0, 0, 0);
+}
+
+/** Press a key with the wm modifier held
+ */
+static
+void press_mod_key(xcb_keycode_t key) {
+    fake_key(key_mod_, XCB_KEY_PRESS);
+    fake_key(key, XCB_KEY_PRESS);
+    fake_key(key, XCB_KEY_RELEASE);
+    fake_key(key_mod_, XCB_KEY_RELEASE);
+    xcb_flush(con_);
+}
+
+static
+xcb_window_t create_window() {
+    xcb_window_t win;
+    uint32_t vals[1];
+
+    win = xcb_generate_id(con_);
+    vals[0] = XCB_EVENT_MASK_STRUCTURE_NOTIFY | XCB_EVENT_MASK_FOCUS_CHANGE;
+    xcb_create_window(con_, XCB_COPY_FROM_PARENT, win, scr_->root, 0, 0,
+        100, 100, 0, XCB_WINDOW_CLASS_INPUT_OUTPUT, scr_->root_visual,
+        XCB_CW_EVENT_MASK, vals);
+    return win;
+}
+
+static
+int cmp_ulong(const void *a, const void *b) {
+    unsigned long x, y;
+
+    x = *(const unsigned long *)a;
+    y = *(const unsigned long *)b;
+    return (x > y) - (x < y);
+}
+
+static
+void report(const char *name, unsigned long *t, unsigned int n) {
+    unsigned long sum;
+    unsigned int i;
+
+    if (n == 0) {
+        return;
+    }
+    sum = 0;
+    for (i = 0; i < n; ++i) {
+        sum += t[i];
+    }
+    qsort(t, n, sizeof(t[0]), &cmp_ulong);
+    printf("%-16s %6u %10lu %10lu %10lu %10lu\n", name, n, sum / n, t[n / 2],
+        t[n * 99 / 100], t[n - 1]);
+    fflush(stdout);
+}
+
+/** CPU time of a process in clock ticks
+ */
+static
+long cpu_ticks(int pid) {
+    char path[32], buf[512], *p;
+    unsigned long utime, stime;
+    FILE *f;
+
+    snprintf(path, sizeof(path), "/proc/%d/stat", pid);
+    f = fopen(path, "r");
+    if (!f) {
+        ERR_("open %s", path);
+        return -1;
+    }
+    if (!fgets(buf, sizeof(buf), f)) {
+        fclose(f);
+        return -1;
+    }
+    fclose(f);
+    /* the command may have spaces, skip after its closing parenthesis */
+    p = strrchr(buf, ')');
+    if (!p || sscanf(p + 2, "%*c %*d %*d %*d %*d %*d %*u %*u %*u %*u %*u %lu %lu",
+        &utime, &stime) != 2) {
+        return -1;
+    }
+    return utime + stime;
+}
+
+static
+xcb_keycode_t find_keycode(xcb_key_symbols_t *syms, xcb_keysym_t sym) {
+    xcb_keycode_t *codes, code;
+
+    codes = xcb_key_symbols_get_keycode(syms, sym);
+    if (!codes) {
+        return 0;
+    }
+    code = codes[0];
+    free(codes);
+    return code;
+}
+
+/** Find keycodes of the wm modifier and of the keys used
+ */
+static
+int init_keys() {
+    xcb_key_symbols_t *syms;
+    xcb_get_modifier_mapping_reply_t *mods;
+    xcb_keycode_t *codes;
+
+    mods = xcb_get_modifier_mapping_reply(con_,
+        xcb_get_modifier_mapping(con_), 0);
+    if (!mods || mods->keycodes_per_modifier == 0) {
+        free(mods);
+        ERR_("no modifier mapping %d", 0);
+        return -1;
+    }
+    codes = xcb_get_modifier_mapping_keycodes(mods);
+    key_mod_ = codes[MOD_INDEX_ * mods->keycodes_per_modifier];
+    free(mods);
+    syms = xcb_key_symbols_alloc(con_);
+    key_next_ = find_keycode(syms, XK_j);
+    key_ws1_ = find_keycode(syms, XK_1);
+    key_ws2_ = find_keycode(syms, XK_2);
+    xcb_key_symbols_free(syms);
+    if (!key_mod_ || !key_next_ || !key_ws1_ || !key_ws2_) {
+        ERR_("missing keycode mod=%u j=%u 1=%u 2=%u", key_mod_, key_next_,
+            key_ws1_, key_ws2_);
+        return -1;
+    }
+    return 0;
+}
+
+/** MapRequest to MapNotify, the workspace grows up to n clients
+ */
+static
+int bench_map(unsigned int n, unsigned long *t) {
+    unsigned long start;
+
+    for (num_wins_ = 0; num_wins_ < n; ++num_wins_) {
+        wins_[num_wins_] = create_window();
+        start = now_us();
+        xcb_map_window(con_, wins_[num_wins_]);
+        xcb_flush(con_);
+        if (wait_events(XCB_MAP_NOTIFY, 1) != 0) {
+            return -1;
+        }
+        t[num_wins_] = now_us() - start;
+    }
+    report("map", t, n);
+    return 0;
+}
+
+/** Injected key press to the FocusIn of the next client
+ */
+static
+int bench_focus(unsigned int rounds, unsigned long *t) {
+    unsigned long start;
+    unsigned int i;
+
+    wait_idle();
+    for (i = 0; i < rounds; ++i) {
+        start = now_us();
+        press_mod_key(key_next_);
+        if (wait_events(XCB_FOCUS_IN, 1) != 0) {
+            return -1;
+        }
+        t[i] = now_us() - start;
+        wait_idle();
+    }
+    report("focus", t, rounds);
+    return 0;
+}
+
+/** Find what is unmapped when the workspace is switched
+ * The wm reparents clients into a container per workspace, watch it instead
+ * of every client.
+ */
+static
+int watch_container() {
+    xcb_query_tree_reply_t *tree;
+    uint32_t vals[1];
+
+    tree = xcb_query_tree_reply(con_, xcb_query_tree(con_, wins_[0]), 0);
+    if (!tree) {
+        ERR_("query tree %u", wins_[0]);
+        return -1;
+    }
+    num_switched_ = num_wins_;
+    if (tree->parent != scr_->root) {
+        vals[0] = XCB_EVENT_MASK_STRUCTURE_NOTIFY;
+        xcb_change_window_attributes(con_, tree->parent, XCB_CW_EVENT_MASK,
+            vals);
+        num_switched_ = 1;
+    }
+    free(tree);
+    return 0;
+}
+
+/** Switch away from and back to a workspace of n clients
+ */
+static
+int bench_change_ws(unsigned int rounds, unsigned long *hide,
+    unsigned long *show) {
+    unsigned long start;
+    unsigned int i;
+
+    if (watch_container() != 0) {
+        return -1;
+    }
+    wait_idle();
+    for (i = 0; i < rounds; ++i) {
+        start = now_us();
+        press_mod_key(key_ws2_);
+        if (wait_events(XCB_UNMAP_NOTIFY, num_switched_) != 0) {
+            return -1;
+        }
+        hide[i] = now_us() - start;
+        start = now_us();
+        press_mod_key(key_ws1_);
+        if (wait_events(XCB_MAP_NOTIFY, num_switched_) != 0) {
+            return -1;
+        }
+        show[i] = now_us() - start;
+        wait_idle();
+    }
+    report("change_ws_hide", hide, rounds);
+    report("change_ws_show", show, rounds);
+    return 0;
+}
+
+/** wm CPU time to open and close windows
+ */
+static
+int bench_cpu(int pid) {
+    xcb_window_t *wins;
+    long ticks;
+    unsigned int i;
+
+    wins = malloc(CPU_WINDOWS_ * sizeof(xcb_window_t));
+    if (!wins) {
+        return -1;
+    }
+    wait_idle();
+    ticks = cpu_ticks(pid);
+    for (i = 0; i < CPU_WINDOWS_; ++i) {
+        wins[i] = create_window();
+        xcb_map_window(con_, wins[i]);
+    }
+    xcb_flush(con_);
+    if (wait_events(XCB_MAP_NOTIFY, CPU_WINDOWS_) != 0) {
+        free(wins);
+        return -1;
+    }
+    for (i = 0; i < CPU_WINDOWS_; ++i) {
+        xcb_destroy_window(con_, wins[i]);
+    }
+    xcb_flush(con_);
+    free(wins);
+    wait_idle();
+    ticks = cpu_ticks(pid) - ticks;
+    printf("%-16s %6u %10ld ms\n", "wm_cpu", CPU_WINDOWS_,
+        ticks * 1000 / sysconf(_SC_CLK_TCK));
+    return 0;
+}
+
+int main(int argc, char **argv) {
+    const xcb_query_extension_reply_t *ext;
+    unsigned long *t1, *t2;
+    unsigned int n, rounds;
+    int opt, pid, ret;
+
+    n = 50;
+    rounds = 100;
+    pid = 0;
+    while ((opt = getopt(argc, argv, "n:r:p:")) != -1) {
+        switch (opt) {
+        case 'n':
+            n = atoi(optarg);
+            break;
+        case 'r':
+            rounds = atoi(optarg);
+            break;
+        case 'p':
+            pid = atoi(optarg);
+            break;
+        default:
+            fprintf(stderr, "usage: %s [-n clients] [-r rounds] [-p wm pid]\n",
+                argv[0]);
+            return 1;
+        }
+    }
+    if (n < 2 || rounds == 0) {
+        ERR_("need 2 clients and 1 round at least, n=%u", n);
+        return 1;
+    }
+    con_ = xcb_connect(0, 0);
+    if (xcb_connection_has_error(con_)) {
+        ERR_("connect %d", xcb_connection_has_error(con_));
+        return 1;
+    }
+    scr_ = xcb_setup_roots_iterator(xcb_get_setup(con_)).data;
+    ext = xcb_get_extension_data(con_, &xcb_test_id);
+    if (!ext || !ext->present) {
+        ERR_("no XTEST extension %d", 0);
+        xcb_disconnect(con_);
+        return 1;
+    }
+    wins_ = malloc(n * sizeof(xcb_window_t));
+    t1 = malloc((n > rounds ? n : rounds) * sizeof(unsigned long));
+    t2 = malloc(rounds * sizeof(unsigned long));
+    ret = 1;
+    if (!wins_ || !t1 || !t2 || init_keys() != 0) {
+        goto end;
+    }
+    printf("# name               n     avg_us     p50_us     p99_us     max_us\n");
+    if (bench_map(n, t1) != 0 || bench_focus(rounds, t1) != 0
+        || bench_change_ws(rounds, t1, t2) != 0) {
+        goto end;
+    }
+    if (pid > 0 && bench_cpu(pid) != 0) {
+        goto end;
+    }
+    ret = 0;
+end:
+    free(wins_);
+    free(t1);
+    free(t2);
+    xcb_disconnect(con_);
+    return ret;
+}
+
+/* vim: set ts=4 sw=4 expandtab: */
@@ -0,0 +1,39 @@
+#!/bin/sh
+# End-to-end latencies of nilwm on a virtual X server, runs offline.
+# usage: stress.sh [clients] [rounds]
+# Needs Xvfb, nilwm and nilwm-stress (make stress) in the current directory.
+
+N=${1:-50}
+ROUNDS=${2:-100}
+DPY=${DPY:-:99}
+NUM=${DPY#:}
+
+Xvfb "$DPY" -screen 0 1280x800x24 -nolisten tcp >/dev/null 2>&1 &
+XVFB=$!
+# wait for the server socket
+i=0
+while [ ! -S "/tmp/.X11-unix/X$NUM" ]; do
+    i=$((i + 1))
+    if [ $i -gt 50 ] || ! kill -0 $XVFB 2>/dev/null; then
+        echo "stress: Xvfb $DPY did not start" >&2
+        kill $XVFB 2>/dev/null
+        exit 1
+    fi
+    sleep 0.1
+done
+
+DISPLAY=$DPY ./nilwm &
+WM=$!
+sleep 0.5
+if ! kill -0 $WM 2>/dev/null; then
+    echo "stress: nilwm did not start" >&2
+    kill $XVFB
+    exit 1
+fi
+
+DISPLAY=$DPY ./nilwm-stress -n "$N" -r "$ROUNDS" -p $WM
+RET=$?
+
+kill $WM $XVFB 2>/dev/null
+wait 2>/dev/null
+exit $RET
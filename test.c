@@ -0,0 +1,480 @@
+/*
+ * Nilwm - Lightweight X window manager.
+ * See LICENSE file for copyright and license details.
+ */
+
+/* Behavior tests of the data path, run against the mock backend.
+ * FocusIn the server would send is followed by calling set_focus.
+ */
+
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include "nilwm.h"
+
+#define NUM_WORKSPACES_     9
+#define WIN_BASE_           0x200000        /* first client window id */
+#define CONTAINER_BASE_     0x100000        /* workspace containers */
+#define NUM_INDEXED_        200             /* grows the index twice */
+#define NUM_POOLED_         130             /* more than two slabs */
+/* top bits of index_hash, equal ones share a bucket up to 4096 buckets */
+#define BUCKET_(W)          ((uint32_t)((W) * 2654435761u) >> 20)
+
+#define CHECK_(cond)        check((cond), #cond, __LINE__)
+
+static struct workspace_t ws_[NUM_WORKSPACES_];
+static xcb_screen_t screen_;
+static int failed_;
+static int pipe_[2];                        /* never readable connection */
+static struct client_t *title_client_;
+static int title_seen_;
+
+/* only fields used by the data path */
+const struct config_t cfg_ = {
+    .mod_key = XCB_MOD_MASK_4,
+    .border_width = 1,
+    .num_workspaces = NUM_WORKSPACES_,
+    .master_size = 55,
+    .motion_interval = 16,
+};
+
+static
+void check(int cond, const char *text, int line) {
+    if (!cond) {
+        fprintf(stderr, "test.c:%d: failed %s\n", line, text);
+        ++failed_;
+    }
+}
+
+static
+struct client_t *add_client(struct workspace_t *ws, xcb_window_t win) {
+    struct client_t *c;
+
+    c = alloc_client(win);
+    if (!c) {
+        exit(1);
+    }
+    c->border_width = cfg_.border_width;
+    NIL_SET_FLAG(c->flags, CLIENT_DISPLAY | CLIENT_MAPPED);
+    attach_client(c, ws);
+    return c;
+}
+
+/** Remove every client and go back to the first workspace
+ */
+static
+void reset() {
+    struct client_t *c;
+    unsigned int i;
+
+    for (i = 0; i < NUM_WORKSPACES_; ++i) {
+        while (ws_[i].first) {
+            c = ws_[i].first;
+            detach_client(c);
+            free_client(c);
+        }
+        memset(&ws_[i], 0, sizeof(ws_[i]));
+        ws_[i].master_size = cfg_.master_size;
+        ws_[i].win = CONTAINER_BASE_ + i;
+    }
+    nil_.ws_idx = 0;
+    mock_clear_requests();
+}
+
+/** Window of the last SetInputFocus request
+ */
+static
+xcb_window_t last_input_focus() {
+    const struct mock_request_t *r;
+    unsigned int i;
+
+    r = mock_requests();
+    for (i = mock_num_requests(); i > 0; --i) {
+        if (r[i - 1].type == XCB_SET_INPUT_FOCUS) {
+            return r[i - 1].win;
+        }
+    }
+    return XCB_NONE;
+}
+
+/** Number of requests of a type on a window
+ */
+static
+unsigned int num_requests(uint8_t type, xcb_window_t win) {
+    const struct mock_request_t *r;
+    unsigned int i, n;
+
+    r = mock_requests();
+    n = 0;
+    for (i = 0; i < mock_num_requests(); ++i) {
+        n += (r[i].type == type) && (r[i].win == win);
+    }
+    return n;
+}
+
+static
+void goto_ws(unsigned int idx) {
+    struct arg_t arg;
+
+    arg.u = idx;
+    change_ws(&arg);
+    settle_ws();
+}
+
+/** A workspace shown again makes its focus the most recent
+ */
+static
+void test_focus_last_after_change_ws() {
+    struct client_t *c[3];
+    struct arg_t arg;
+    unsigned int i;
+
+    reset();
+    for (i = 0; i < 3; ++i) {
+        goto_ws(i);
+        c[i] = add_client(&ws_[i], WIN_BASE_ + i);
+        set_focus(&ws_[i], c[i]);
+    }
+    goto_ws(0);
+    goto_ws(2);
+    CHECK_(nil_.mru == c[2]);
+    CHECK_(nil_.mru->gmru_next == c[0]);
+    arg.u = 0;
+    focus_last(&arg);
+    CHECK_(nil_.ws_idx == 0);
+    CHECK_(last_input_focus() == c[0]->win);
+}
+
+/** FocusIn on the kept focus of a workspace touches the history too
+ */
+static
+void test_focus_in_kept_focus() {
+    struct client_t *a, *b;
+
+    reset();
+    a = add_client(&ws_[0], WIN_BASE_);
+    b = add_client(&ws_[1], WIN_BASE_ + 1);
+    set_focus(&ws_[0], a);
+    set_focus(&ws_[1], b);
+    CHECK_(nil_.mru == b);
+    set_focus(&ws_[0], a);
+    CHECK_(nil_.mru == a);
+    CHECK_(a->gmru_next == b);
+}
+
+/** The focus goes back to the most recent client that can take it
+ */
+static
+void test_restore_focus_skips_hidden() {
+    struct client_t *a, *b, *c;
+
+    reset();
+    a = add_client(&ws_[0], WIN_BASE_);
+    b = add_client(&ws_[0], WIN_BASE_ + 1);
+    c = add_client(&ws_[0], WIN_BASE_ + 2);
+    set_focus(&ws_[0], a);
+    set_focus(&ws_[0], b);
+    set_focus(&ws_[0], c);
+    NIL_CLEAR_FLAG(b->flags, CLIENT_DISPLAY);
+    detach_client(c);
+    free_client(c);
+    restore_focus(&ws_[0]);
+    CHECK_(ws_[0].focus == a);
+    CHECK_(last_input_focus() == a->win);
+
+    /* none left, the root has it */
+    detach_client(a);
+    free_client(a);
+    restore_focus(&ws_[0]);
+    CHECK_(ws_[0].focus == 0);
+    CHECK_(last_input_focus() == screen_.root);
+}
+
+/** Lookups stay right when the index grows and when a chain loses an entry
+ */
+static
+void test_index_lookup() {
+    struct client_t *c[NUM_INDEXED_], *a, *b;
+    struct workspace_t *ws;
+    xcb_window_t win;
+    unsigned int i;
+    int found;
+
+    reset();
+    for (i = 0; i < NUM_INDEXED_; ++i) {
+        c[i] = add_client(&ws_[i % NUM_WORKSPACES_], WIN_BASE_ + i);
+    }
+    found = 1;
+    for (i = 0; i < NUM_INDEXED_; ++i) {
+        found = found && (find_client(WIN_BASE_ + i, &ws) == c[i])
+            && (ws == &ws_[i % NUM_WORKSPACES_]);
+    }
+    CHECK_(found);
+    CHECK_(find_client(WIN_BASE_ + NUM_INDEXED_, 0) == 0);
+
+    /* two windows in the same bucket, either one removed */
+    win = WIN_BASE_ + NUM_INDEXED_ + 1;
+    while (BUCKET_(win) != BUCKET_(WIN_BASE_ + NUM_INDEXED_)) {
+        ++win;
+    }
+    a = add_client(&ws_[0], WIN_BASE_ + NUM_INDEXED_);
+    b = add_client(&ws_[0], win);
+    detach_client(b);
+    free_client(b);
+    CHECK_(find_client(win, 0) == 0);
+    CHECK_(find_client(WIN_BASE_ + NUM_INDEXED_, 0) == a);
+    b = add_client(&ws_[0], win);
+    detach_client(a);
+    free_client(a);
+    CHECK_(find_client(WIN_BASE_ + NUM_INDEXED_, 0) == 0);
+    CHECK_(find_client(win, 0) == b);
+}
+
+/** A freed client comes back from the pool zeroed, no slab is added
+ */
+static
+void test_slab_reuse() {
+    struct client_t *c[NUM_POOLED_], *a;
+    unsigned int i, j;
+    int reused;
+
+    reset();
+    a = add_client(&ws_[0], WIN_BASE_);
+    set_focus(&ws_[0], a);
+    if (reserve_text(&a->title, 3) == 0) {
+        memcpy(a->title.s, "old", 4);
+        a->title.len = 3;
+    }
+    NIL_SET_FLAG(a->flags, CLIENT_FLOAT);
+    detach_client(a);
+    free_client(a);
+    CHECK_(nil_.mru == 0);
+    CHECK_(alloc_client(WIN_BASE_ + 1) == a);
+    CHECK_(a->win == WIN_BASE_ + 1);
+    CHECK_(a->flags == 0 && a->title.s == 0 && a->title.len == 0);
+    CHECK_(a->mru_prev == 0 && a->gmru_prev == 0 && a->ws == 0);
+    free_client(a);
+
+    for (i = 0; i < NUM_POOLED_; ++i) {
+        c[i] = add_client(&ws_[0], WIN_BASE_ + i);
+    }
+    reset();
+    /* every client comes from the slabs already allocated */
+    reused = 1;
+    for (i = 0; i < NUM_POOLED_; ++i) {
+        a = add_client(&ws_[0], WIN_BASE_ + i);
+        for (j = 0; (j < NUM_POOLED_) && (c[j] != a); ++j) {
+        }
+        reused = reused && (j < NUM_POOLED_);
+    }
+    CHECK_(reused);
+}
+
+/** Monocle maps the focused client only, a focus move costs a map and an unmap
+ */
+static
+void test_monocle_focus() {
+    struct client_t *c[3], *prev, *next;
+    struct arg_t arg;
+    unsigned int i;
+
+    reset();
+    for (i = 0; i < 3; ++i) {
+        c[i] = add_client(&ws_[0], WIN_BASE_ + i);
+    }
+    ws_[0].layout = LAYOUT_MONO;
+    set_focus(&ws_[0], c[0]);
+    mark_ws(&ws_[0]);
+    settle_ws();
+    CHECK_(!NIL_HAS_FLAG(c[0]->flags, CLIENT_HIDDEN));
+    CHECK_(NIL_HAS_FLAG(c[1]->flags, CLIENT_HIDDEN));
+    CHECK_(NIL_HAS_FLAG(c[2]->flags, CLIENT_HIDDEN));
+
+    for (i = 0; i < 3; ++i) {
+        prev = ws_[0].focus;
+        mock_clear_requests();
+        arg.i = NAV_NEXT;
+        focus(&arg);
+        next = ws_[0].focus;
+        CHECK_(next != prev);
+        CHECK_(!NIL_HAS_FLAG(next->flags, CLIENT_HIDDEN));
+        CHECK_(NIL_HAS_FLAG(prev->flags, CLIENT_HIDDEN));
+        CHECK_(num_requests(XCB_MAP_WINDOW, next->win) == 1);
+        CHECK_(num_requests(XCB_UNMAP_WINDOW, prev->win) == 1);
+        CHECK_(last_input_focus() == next->win);
+    }
+
+    /* the focused client is gone, the next one of the history is shown */
+    prev = ws_[0].focus;
+    detach_client(prev);
+    free_client(prev);
+    restore_focus(&ws_[0]);
+    mark_ws(&ws_[0]);
+    settle_ws();
+    CHECK_(ws_[0].focus && !NIL_HAS_FLAG(ws_[0].focus->flags, CLIENT_HIDDEN));
+
+    /* leaving monocle shows every client */
+    ws_[0].layout = LAYOUT_TILE;
+    arrange_ws(&ws_[0]);
+    for (next = ws_[0].first; next; next = next->next) {
+        CHECK_(!NIL_HAS_FLAG(next->flags, CLIENT_HIDDEN));
+    }
+}
+
+/** Drop a tiled client onto another one, as a mouse move would
+ */
+static
+void drag_tile(struct client_t *c, struct client_t *target) {
+    struct mouse_event_t e;
+
+    e.mode = CURSOR_MOVE;
+    e.client = c;
+    e.ws = c->ws;
+    e.x1 = e.x2 = target->x + 1;
+    e.y1 = e.y2 = target->y + 1;
+    (*get_layout(c->ws)->move)(c->ws, &e);
+    settle_ws();
+}
+
+/** The four clients of a workspace are in this order, with consistent links
+ */
+static
+int has_order(struct workspace_t *ws, struct client_t *c0, struct client_t *c1,
+    struct client_t *c2, struct client_t *c3) {
+    struct client_t *cs[4] = { c0, c1, c2, c3 };
+    struct client_t *c;
+    unsigned int i;
+
+    c = ws->first;
+    for (i = 0; i < NIL_LEN(cs); ++i, c = c->next) {
+        if (c != cs[i] || *c->prev != c) {
+            return 0;
+        }
+    }
+    return !c && (ws->last == c3);
+}
+
+/** A dragged tile goes before a target above it, after one below it
+ */
+static
+void test_move_tile_order() {
+    struct client_t *a, *b, *c, *d;
+
+    reset();
+    /* attached at the head: a b c d */
+    d = add_client(&ws_[0], WIN_BASE_ + 3);
+    c = add_client(&ws_[0], WIN_BASE_ + 2);
+    b = add_client(&ws_[0], WIN_BASE_ + 1);
+    a = add_client(&ws_[0], WIN_BASE_);
+    ws_[0].layout = LAYOUT_TILE;
+    mark_ws(&ws_[0]);
+    settle_ws();
+
+    /* to the head, onto the master */
+    drag_tile(d, a);
+    CHECK_(has_order(&ws_[0], d, a, b, c));
+    /* from the head to the middle */
+    drag_tile(d, b);
+    CHECK_(has_order(&ws_[0], a, b, d, c));
+    /* to the tail */
+    drag_tile(a, c);
+    CHECK_(has_order(&ws_[0], b, d, c, a));
+    /* from the tail to the middle */
+    drag_tile(a, d);
+    CHECK_(has_order(&ws_[0], b, a, d, c));
+}
+
+static
+int get_pipe_fd() {
+    return pipe_[0];
+}
+
+/** Ends the loop, the title must be there already
+ */
+static
+void handle_stop_timer(struct watch_t *NIL_UNUSED(self)) {
+    title_seen_ = title_client_->title.s
+        && (strcmp(title_client_->title.s, "new") == 0);
+    stop_events();
+}
+
+/** A title reply already read by xcb is taken without another wakeup
+ * The mock answers at the first poll and its connection never wakes epoll,
+ * like a reply read while flushing.
+ */
+static
+void test_buffered_title_reply() {
+    struct window_info_t info;
+    struct backend_t be;
+    struct watch_t timer = { .fd = -1 };
+    char buf[NIL_EVENT_SIZE];
+    xcb_property_notify_event_t *e = (xcb_property_notify_event_t *)buf;
+
+    reset();
+    memset(&info, 0, sizeof(info));
+    info.title = "new";
+    mock_add_window(WIN_BASE_, &info);
+    title_client_ = add_client(&ws_[0], WIN_BASE_);
+    set_focus(&ws_[0], title_client_);
+    mark_title(title_client_);
+
+    be = backend_mock_;
+    be.get_fd = &get_pipe_fd;
+    nil_.be = &be;
+    if (pipe(pipe_) != 0 || init_loop() != 0) {
+        CHECK_(!"init_loop");
+        nil_.be = &backend_mock_;
+        return;
+    }
+    timer.func = &handle_stop_timer;
+    add_timer(&timer);
+    set_timer(&timer, 200, 0);
+    /* one ignored event for the first iteration, it sends the fetch */
+    memset(buf, 0, sizeof(buf));
+    e->response_type = XCB_PROPERTY_NOTIFY;
+    e->window = screen_.root;
+    e->atom = XCB_ATOM_WM_ICON_NAME;
+    mock_push_event(buf);
+    title_seen_ = 0;
+    recv_events();
+    CHECK_(title_seen_);
+    del_watch(&timer);
+    cleanup_loop();
+    close(pipe_[0]);
+    close(pipe_[1]);
+    nil_.be = &backend_mock_;
+}
+
+int main() {
+    nil_.be = &backend_mock_;
+    screen_.width_in_pixels = 1920;
+    screen_.height_in_pixels = 1080;
+    screen_.root = 1;
+    nil_.scr = &screen_;
+    nil_.x = 0;
+    nil_.y = 16;
+    nil_.w = 1920;
+    nil_.h = 1080 - 16;
+    nil_.ws = ws_;
+
+    test_focus_last_after_change_ws();
+    test_focus_in_kept_focus();
+    test_restore_focus_skips_hidden();
+    test_index_lookup();
+    test_slab_reuse();
+    test_monocle_focus();
+    test_move_tile_order();
+    test_buffered_title_reply();
+
+    reset();
+    cleanup_clients();
+    mock_reset();
+    if (failed_) {
+        fprintf(stderr, "%d checks failed\n", failed_);
+        return 1;
+    }
+    printf("all tests passed\n");
+    return 0;
+}
+
+/* vim: set ts=4 sw=4 expandtab: */